@@ -24,22 +24,26 @@ OUT (out5,              C,    6,   trommelbremse_zu        )
 OUT (out6,              C,    7,   auszugsbremse_auf       )
 
 // Konfiguration der Eingänge
-// (Name,               Port, Bit, Alias                      )
-IN (schalter1,          E,    2,                              )
-IN (schalter2,          E,    3,                              )
-IN (schalter3,          E,    4,   schalter_einkuppeln_links  )
-IN (schalter4,          E,    5,   schalter_einkuppeln_rechts )
-IN (schalter5,          E,    6,   schalter_auskuppeln        )
-IN (schalter6,          B,    5,   schalter_auszugsbremse_auf )
-IN (in1,                D,    7,   bremse_getreten            )
-IN (in2,                D,    6,   gang_falsch                )
-IN (in3,                D,    5,   parkbremse_gezogen         )
-IN (in4,                D,    4,                              )
-IN (in5,                D,    3,   motor_temp_zu_hoch         )
-IN (in6,                D,    2,   wandler_temp_zu_hoch       )
-IN (in7,                D,    1,                              )
-IN (in8,                D,    0,   motor_an                   )
-IN (in9,                B,    7,   kappvorrichtung_falsch     )
+// Filter: Anzahl aufeinanderfolgender gleicher Abtastungen im Abstand von 1 ms (1-8),
+// bis eine Änderung übernommen wird, leer bedeutet keine Entprellung
+// Interrupt: 1 übernimmt Flanken sofort über den externen Interrupt, danach entprellt
+// der Filter. Nur an den Pins INT0-INT7 (D0-D3, E4-E7) möglich.
+// (Name,               Port, Bit, Alias,                       Filter, Interrupt )
+IN (schalter1,          E,    2,   ,                            4,                )
+IN (schalter2,          E,    3,   ,                            4,                )
+IN (schalter3,          E,    4,   schalter_einkuppeln_links,   4,                )
+IN (schalter4,          E,    5,   schalter_einkuppeln_rechts,  4,                )
+IN (schalter5,          E,    6,   schalter_auskuppeln,         4,      1         )
+IN (schalter6,          B,    5,   schalter_auszugsbremse_auf,  4,                )
+IN (in1,                D,    7,   bremse_getreten,             ,                 )
+IN (in2,                D,    6,   gang_falsch,                 ,                 )
+IN (in3,                D,    5,   parkbremse_gezogen,          ,                 )
+IN (in4,                D,    4,   ,                            ,                 )
+IN (in5,                D,    3,   motor_temp_zu_hoch,          ,                 )
+IN (in6,                D,    2,   wandler_temp_zu_hoch,        ,                 )
+IN (in7,                D,    1,   ,                            ,                 )
+IN (in8,                D,    0,   motor_an,                    ,       1         )
+IN (in9,                B,    7,   kappvorrichtung_falsch,      ,                 )
 
 // Zustände des Automaten
 //    (Zustandsname,        Graphviz-Attribute )
@@ -57,6 +61,8 @@ STATE (fehler_motor_an,     (RED)              )
 STATE (fehler_motor_aus,    (RED)              )
 
 // Ereignisse, die Zustandsübergänge auslösen
+// Reine Und-Verknüpfungen von Eingängen (in.x && !in.y ...) werden von host/genlookup
+// in einen Masken-Vergleich über in.bitfield umgesetzt
 //    (Ereignisname,   Boolescher Ausdruck                                                    )
 EVENT (aufbau_ok,      !in.kappvorrichtung_falsch && in.parkbremse_gezogen && !in.gang_falsch )
 EVENT (temp_ok,        !in.motor_temp_zu_hoch && !in.wandler_temp_zu_hoch                     )
@@ -80,6 +86,10 @@ ACTION (zuendungsbruecke_an,  out.zuendungsbruecke = 1;
 ACTION (zuendungsbruecke_aus, out.zuendungsbruecke = 0;                                     )
 
 // Übergänge zwischen Zuständen
+// AFTER(ms) ist als Ereignis wahr, wenn der Automat seit ms Millisekunden im
+// Anfangszustand ist. Zeitgeber werden bei Bedarf mit TIMER (name) vereinbart, in
+// Aktionen mit TIMER_START(name, ms) gestartet und mit TIMER_STOP(name) angehalten,
+// TIMER_EXPIRED(name) ist in Ereignissen wahr, sobald die Zeit abgelaufen ist.
 //         (Anfangszustand,      Ereignis (Boolescher Ausdurck), Endzustand,          Aktion,               Graphviz-Attribute )
 TRANSITION (start,               1,                              trommeln_gebremst,   trommelbremse_zu,     (GREEN)            )
 TRANSITION (trommeln_gebremst,   aufbau_ok,                      aufbau_ok,           ,                     (GREEN)            )
@@ -110,13 +120,31 @@ TRANSITION (fehler_motor_an,     aufbau_ok,                      motor_an,
 TRANSITION (fehler_motor_an,     !in.motor_an,                   fehler_motor_aus,    ,                     (RED)              )
 TRANSITION (fehler_motor_aus,    1,                              temp_ok,             zuendungsbruecke_aus, ()                 )
 
+// Sicherheitsbedingungen, die nach jedem Scan im Automatikmodus gelten müssen.
+// Werden mit host/statecheck für alle erreichbaren Zustände geprüft.
+//        (Name,                     Boolescher Ausdruck                                           )
+INVARIANT (eine_trommel,             !(out.einkuppeln_links && out.einkuppeln_rechts)               )
+INVARIANT (trommelbremse_zu,         out.einkuppeln_links || out.einkuppeln_rechts ||
+                                     out.trommelbremse_zu                                          )
+
 // Kommandos der Debug-Schnittstelle
-//      (Name,    Funktion, Argumente,           Hilfe                                              )
-COMMAND (in,      in,       "",                  "Print list of input ports"                        )
-COMMAND (out,     out,      "",                  "Print list of output ports"                       )
-COMMAND (on,      on_off,   "<port>",            "Set port on"                                      )
-COMMAND (off,     on_off,   "<port>",            "Set port off"                                     )
-COMMAND (mode,    mode,     "[--auto|--manual]", "Print or switch between automatic or manual mode" )
-COMMAND (reset,   reset,    "",                  "Reset output ports"                               )
-COMMAND (help,    help,     "[command]",         "Print this help"                                  )
-COMMAND (version, version,  "",                  "Print version"                                    )
+//      (Name,      Funktion,  Argumente,               Hilfe                                                 )
+COMMAND (in,        in,        "",                      "Print list of input ports"                           )
+COMMAND (out,       out,       "",                      "Print list of output ports"                          )
+COMMAND (on,        on_off,    "<port>",                "Set port on"                                         )
+COMMAND (off,       on_off,    "<port>",                "Set port off"                                        )
+COMMAND (io,        io,        "[+|-<port|0xmask>]...", "Print in/out words in hex or switch outputs at once" )
+COMMAND (mode,      mode,      "[--auto|--manual]",     "Print or switch between automatic or manual mode"    )
+COMMAND (reset,     reset,     "",                      "Reset output ports"                                  )
+COMMAND (scan,      scan,      "[--reset]",             "Print or reset scan timing statistics"               )
+COMMAND (telemetry, telemetry, "[--off|<ms>]",          "Print, stop or start binary telemetry records"       )
+COMMAND (log,       log,       "[--clear]",             "Print or clear the fault log in the EEPROM"          )
+COMMAND (uart,      uart,      "[--reset]",             "Print or reset receive error counters"               )
+COMMAND (restarts,  restarts,  "[--reset]",             "Print or reset reset counters since power-on"        )
+COMMAND (stats,     stats,     "[--reset|--export]",    "Print, reset or export state machine counters"       )
+COMMAND (mem,       mem,       "[--reset]",             "Print RAM use or restart the stack measurement"      )
+#ifdef PROFILE
+COMMAND (prof,      prof,      "[--reset]",             "Print or reset profile of the main loop stages"      )
+#endif
+COMMAND (help,      help,      "[command]",             "Print this help"                                     )
+COMMAND (version,   version,   "",                      "Print version"                                       )
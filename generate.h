@@ -6,7 +6,7 @@
 #  define OUT(name, port, bit, alias)
 #endif
 #ifndef IN
-#  define IN(name, port, bit, alias)
+#  define IN(name, port, bit, alias, filter, irq)
 #endif
 #ifndef STATE
 #  define STATE(name, attrs)
@@ -23,6 +23,12 @@
 #ifndef COMMAND
 #  define COMMAND(name, fn, args, help)
 #endif
+#ifndef INVARIANT
+#  define INVARIANT(name, condition)
+#endif
+#ifndef TIMER
+#  define TIMER(name)
+#endif
 
 #include "config.h"
 
@@ -33,3 +39,5 @@
 #undef EVENT
 #undef TRANSITION
 #undef COMMAND
+#undef INVARIANT
+#undef TIMER
@@ -0,0 +1,175 @@
+/**
+ * @file
+ *
+ * Hardware abstraction layer. On the AVR everything maps directly onto
+ * the registers of the ATmega64, on the host (HAL_HOST) the registers are
+ * emulated by plain variables which are implemented in host/hal.c.
+ */
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Ports of the ATmega64, HAL_PORTS(f) expands f(port) for each port
+enum { HAL_A, HAL_B, HAL_C, HAL_D, HAL_E, HAL_F, HAL_G, HAL_NPORTS };
+#define HAL_PORTS(f) f(A) f(B) f(C) f(D) f(E) f(F) f(G)
+
+// Fill of the free RAM at startup, the stack overwrites it
+#define HAL_RAM_PAINT 0xC5
+
+#ifdef __AVR__
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+#define HAL_PIN(port)  PIN  ## port
+#define HAL_PORT(port) PORT ## port
+#define HAL_DDR(port)  DDR  ## port
+
+// busy waiting, nothing to do on the AVR since the interrupts run anyway
+#define hal_wait()
+
+// EEPROM access, the caller makes sure that no write is in progress.
+// EEWE must be set within four cycles after EEMWE.
+#define hal_eeprom_busy() (EECR & (1 << EEWE))
+static inline uint8_t hal_eeprom_read(uint16_t addr) {
+        EEAR = addr;
+        EECR |= 1 << EERE;
+        return EEDR;
+}
+static inline void hal_eeprom_write(uint16_t addr, uint8_t data) {
+        EEAR = addr;
+        EEDR = data;
+        EECR |= 1 << EEMWE;
+        EECR |= 1 << EEWE;
+}
+
+// not cleared by the startup code, survives resets without power loss
+#define HAL_NOINIT __attribute__((section(".noinit")))
+
+// RAM from RAMSTART to RAMEND, the static data including .noinit ends at
+// __heap_start and the stack grows down from RAMEND. SP addresses the next
+// free byte, everything below it is unused.
+extern uint8_t __heap_start;
+#define hal_ram_start()  ((uint8_t*)RAMSTART)
+#define hal_ram_static() (&__heap_start)
+#define hal_ram_end()    ((uint8_t*)RAMEND)
+#define hal_sp()         ((uint8_t*)SP)
+
+#else
+
+#define HAL_HOST
+
+#define HAL_PIN(port)  hal_pin[HAL_ ## port]
+#define HAL_PORT(port) hal_port[HAL_ ## port]
+#define HAL_DDR(port)  hal_ddr[HAL_ ## port]
+
+extern volatile uint8_t hal_pin[HAL_NPORTS], hal_port[HAL_NPORTS], hal_ddr[HAL_NPORTS];
+extern volatile uint8_t OSCCAL, UDR0, UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+extern volatile uint8_t TCCR0, OCR0, TIMSK, TCCR1B;
+extern volatile uint8_t EICRA, EICRB, EIMSK, EIFR, EECR, MCUCSR;
+extern FILE* hal_uart_tx;
+
+// Timer1 counts with F_CPU, emulated by the host clock
+#define TCNT1 hal_tcnt1()
+
+// bit numbers of the ATmega64 USART registers
+#define RXCIE 7
+#define UDRIE 5
+#define RXEN  4
+#define TXEN  3
+#define UCSZ1 2
+#define UCSZ0 1
+#define U2X   1
+#define FE    4
+#define DOR   3
+
+// bit numbers of the ATmega64 timer registers
+#define WGM01 3
+#define CS01  1
+#define CS00  0
+#define OCIE0 1
+#define CS10  0
+
+// reset flags of the ATmega64, all clear for the host
+#define JTRF  4
+#define WDRF  3
+#define BORF  2
+#define EXTRF 1
+#define PORF  0
+
+// the host memory is cleared at startup
+#define HAL_NOINIT
+
+// RAM of the ATmega64, painted at startup. The static data and the stack
+// of the host are elsewhere, so all of it is free.
+#define RAMSTART 0x100
+#define RAMEND   0x10FF
+extern uint8_t hal_ram[RAMEND + 1];
+#define hal_ram_start()  (hal_ram + RAMSTART)
+#define hal_ram_static() (hal_ram + RAMSTART)
+#define hal_ram_end()    (hal_ram + RAMEND)
+#define hal_sp()         (hal_ram + RAMEND)
+
+// EEPROM of the ATmega64, writes complete immediately
+#define E2END 0x7FF
+#define EERIE 3
+extern uint8_t hal_eeprom[E2END + 1];
+#define hal_eeprom_busy()             0
+#define hal_eeprom_read(addr)         hal_eeprom[addr]
+#define hal_eeprom_write(addr, data)  (hal_eeprom[addr] = (data))
+
+// replacement for util/setbaud.h
+#define UBRRH_VALUE 0
+#define UBRRL_VALUE 0
+#define USE_2X      0
+
+#define ISR(vector) void vector(void)
+ISR(USART0_RX_vect);
+ISR(USART0_UDRE_vect);
+ISR(TIMER0_COMP_vect);
+ISR(EE_READY_vect);
+ISR(INT0_vect);
+ISR(INT1_vect);
+ISR(INT2_vect);
+ISR(INT3_vect);
+ISR(INT4_vect);
+ISR(INT5_vect);
+ISR(INT6_vect);
+ISR(INT7_vect);
+
+#define sei()
+#define cli()
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for (int hal_atomic = 1; hal_atomic; hal_atomic = 0)
+
+// CRC-8 with polynomial x^8 + x^2 + x + 1 as in util/crc16.h
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data) {
+        crc ^= data;
+        for (uint8_t i = 0; i < 8; ++i)
+                crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+        return crc;
+}
+
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define pgm_read_byte(p)        (*(const uint8_t*)(p))
+#define pgm_read_word(p)        (*(const uint16_t*)(p))
+#define pgm_read_ptr(p)         (*(void* const*)(p))
+#define memcpy_P(dst, src, n)   memcpy(dst, src, n)
+#define strcmp_P(a, b)          strcmp(a, b)
+#define strsep_P(s, delim)      strsep(s, delim)
+
+void hal_wait();
+void hal_poll();
+void hal_uart_rx(char c);
+void hal_pin_write(uint8_t port, uint8_t value);
+uint16_t hal_tcnt1();
+
+#endif
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * @file
+ *
+ * Throughput benchmark of the scan cycle on the host.
+ * The host has no timer interrupt, each scan advances the ticks by one.
+ * Usage: bench [-n scans] [idle|random|launch]...
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pins.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#  define cycles() __rdtsc()
+#else
+#  define cycles() 0
+#endif
+
+#define ARRAY_SIZE(array) (sizeof (array) / sizeof (array[0]))
+#define HOLD 16
+
+typedef struct {
+        const char* name;
+        void (*input)(in_t* in, unsigned long scan);
+} pattern_t;
+
+static void input_idle(in_t* in, unsigned long scan) {
+        (void)scan;
+        memset(in, 0, sizeof (in_t));
+}
+
+static void input_random(in_t* in, unsigned long scan) {
+        static uint32_t x = 2463534242u;
+        (void)scan;
+        for (size_t i = 0; i < sizeof (in_t); ++i) {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                in->bitfield[i] = x;
+        }
+}
+
+// One full launch with the left and one with the right drum
+static void input_launch(in_t* in, unsigned long scan) {
+        static const in_t steps[] = {
+                { },
+                { .parkbremse_gezogen = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1, .schalter_einkuppeln_links = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1, .schalter_auskuppeln = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1, .schalter_einkuppeln_rechts = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1, .schalter_auskuppeln = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1, .bremse_getreten = 1 },
+                { .parkbremse_gezogen = 1, .motor_an = 1 },
+                { .parkbremse_gezogen = 1 },
+        };
+        *in = steps[(scan / HOLD) % ARRAY_SIZE(steps)];
+}
+
+static const pattern_t patterns[] = {
+        { "idle",   input_idle   },
+        { "random", input_random },
+        { "launch", input_launch },
+};
+
+static void run(FILE* console, const pattern_t* pattern, unsigned long scans) {
+        in_t input;
+        unsigned long transitions = 0;
+        struct timespec t0, t1;
+
+        state = 0;
+        memset(&flag, 0, sizeof (flag));
+        memset(&in, 0, sizeof (in));
+        memset(&last_in, 0, sizeof (last_in));
+        memset(&out, 0, sizeof (out));
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t c0 = cycles();
+        for (unsigned long i = 0; i < scans; ++i) {
+                pattern->input(&input, i);
+                pins_set(&input);
+                ++timer_ticks;
+                uint8_t old_state = state;
+                winde_scan();
+                hal_poll();
+                transitions += state != old_state;
+        }
+        uint64_t c1 = cycles();
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        fprintf(console, "%-8s %10lu %10.1f %12.1f %12lu %14.0f\n",
+                pattern->name, scans, ns / scans, (double)(c1 - c0) / scans,
+                transitions, transitions / (ns / 1e9));
+}
+
+int main(int argc, char* argv[]) {
+        unsigned long scans = 4000000;
+        int first = 1;
+        if (argc > 2 && !strcmp(argv[1], "-n")) {
+                scans = strtoul(argv[2], 0, 0);
+                first = 3;
+        }
+
+        winde_init();
+        hal_poll();
+        // wait for the end of the latch reset
+        while (flag.latch_reset) {
+                ++timer_ticks;
+                winde_scan();
+                hal_poll();
+        }
+
+        printf("%-8s %10s %10s %12s %12s %14s\n",
+                "pattern", "scans", "ns/scan", "cycles/scan", "transitions", "transitions/s");
+        for (size_t i = 0; i < ARRAY_SIZE(patterns); ++i) {
+                int selected = first == argc;
+                for (int j = first; j < argc; ++j)
+                        selected |= !strcmp(argv[j], patterns[i].name);
+                if (selected)
+                        run(stdout, patterns + i, scans);
+        }
+        return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file
+ *
+ * Generates lookup.h, a collision-free hash table of the command names
+ * and the output names and aliases of config.h. It has to be built with the
+ * defines of the firmware, the COMMAND table depends on them.
+ *
+ * Each EVENT which is a pure conjunction of inputs, e.g. "in.a && !in.b",
+ * is lowered to one mask and value test per byte of in.bitfield. Other
+ * events stay C code.
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "winde.h"
+
+#define ARRAY_SIZE(array) (sizeof (array) / sizeof (array[0]))
+#define KEY(kind, name, value) { (LOOKUP_##kind << 6) | (value), name },
+
+typedef struct {
+        uint8_t     value;
+        const char* name;
+} lookup_key_t;
+
+enum {
+#define COMMAND(name, fn, args, help) CMD_##name,
+#include "generate.h"
+        CMD_COUNT
+};
+
+_Static_assert(CMD_COUNT <= LOOKUP_INDEX + 1, "Too many commands");
+_Static_assert(OUT_COUNT <= LOOKUP_INDEX + 1, "Too many outputs");
+
+static const lookup_key_t keys[] = {
+#define COMMAND(name, fn, args, help) KEY(CMD, #name, CMD_##name)
+#define OUT(name, port, bit, alias) \
+        KEY(OUT, #name, OUT_##name) \
+        KEY(OUT, IF_EMPTY(alias, 0, #alias), LOOKUP_ALIAS | OUT_##name)
+#include "generate.h"
+};
+
+static const struct {
+        const char* name;
+        in_t        bit;
+} inputs[] = {
+#define IN(name, port, bit, alias, filter, irq) \
+        { #name, {{ .name = 1 }} }, { IF_EMPTY(alias, 0, #alias), {{ .name = 1 }} },
+#include "generate.h"
+};
+
+static const struct {
+        const char *name, *condition;
+} events[] = {
+#define EVENT(name, condition) { #name, #condition },
+#include "generate.h"
+};
+
+// Mask and value of a condition "[!]in.<input> && ...", returns 0 for any
+// other expression
+static int lower(const char* s, in_t* mask, in_t* value) {
+        memset(mask, 0, sizeof (*mask));
+        memset(value, 0, sizeof (*value));
+        for (;;) {
+                while (*s == ' ')
+                        ++s;
+                int negated = *s == '!';
+                s += negated;
+                while (*s == ' ')
+                        ++s;
+                if (strncmp(s, "in.", 3))
+                        return 0;
+                s += 3;
+                size_t n = 0, i;
+                while (isalnum((unsigned char)s[n]) || s[n] == '_')
+                        ++n;
+                for (i = 0; i < ARRAY_SIZE(inputs); ++i) {
+                        if (inputs[i].name && strlen(inputs[i].name) == n && !strncmp(s, inputs[i].name, n))
+                                break;
+                }
+                if (i == ARRAY_SIZE(inputs))
+                        return 0;
+                s += n;
+                for (size_t j = 0; j < sizeof (in_t); ++j) {
+                        uint8_t bit = inputs[i].bit.bitfield[j];
+                        // an input tested both ways is left to the compiler
+                        if ((mask->bitfield[j] & bit) && !(value->bitfield[j] & bit) != negated)
+                                return 0;
+                        mask->bitfield[j] |= bit;
+                        if (!negated)
+                                value->bitfield[j] |= bit;
+                }
+                while (*s == ' ')
+                        ++s;
+                if (!*s)
+                        return 1;
+                if (strncmp(s, "&&", 2))
+                        return 0;
+                s += 2;
+        }
+}
+
+static void print_events() {
+        for (size_t i = 0; i < ARRAY_SIZE(events); ++i) {
+                in_t mask, value;
+                if (!lower(events[i].condition, &mask, &value)) {
+                        printf("#define EVENT_LOWERED_%s 0\n", events[i].name);
+                        continue;
+                }
+                printf("#define EVENT_LOWERED_%s 1\n#define EVENT_MASK_%s (", events[i].name, events[i].name);
+                const char* and = "";
+                for (size_t j = 0; j < sizeof (in_t); ++j) {
+                        if (!mask.bitfield[j])
+                                continue;
+                        printf("%s(in.bitfield[%zu] & 0x%02x) == 0x%02x", and, j, mask.bitfield[j], value.bitfield[j]);
+                        and = " && ";
+                }
+                printf(")\n");
+        }
+}
+
+int main() {
+        uint8_t table[LOOKUP_SIZE];
+        for (uint32_t seed = 0; seed <= 0xFFFF; ++seed) {
+                size_t i;
+                memset(table, 0, sizeof (table));
+                for (i = 0; i < ARRAY_SIZE(keys); ++i) {
+                        if (!keys[i].name)
+                                continue;
+                        uint8_t h = lookup_hash(seed, keys[i].value >> 6, keys[i].name);
+                        if (table[h])
+                                break;
+                        table[h] = keys[i].value;
+                }
+                if (i < ARRAY_SIZE(keys))
+                        continue;
+
+                printf("// Generated by genlookup from config.h, do not edit\n"
+                       "#define LOOKUP_SEED  %u\n"
+                       "#define LOOKUP_TABLE", seed);
+                for (i = 0; i < LOOKUP_SIZE; ++i)
+                        printf(i % 16 ? " 0x%02x," : " \\\n        0x%02x,", table[i]);
+                putchar('\n');
+                print_events();
+                return 0;
+        }
+        fprintf(stderr, "No collision-free seed found\n");
+        return 1;
+}
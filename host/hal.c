@@ -0,0 +1,74 @@
+/**
+ * @file
+ *
+ * Host emulation of the ATmega64 registers used by winde.c.
+ * The UART transmits with infinite speed into hal_uart_tx.
+ * Changes of the pins by hal_pin_write raise the external interrupts.
+ * The EEPROM starts erased and is written without delay.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hal.h"
+
+volatile uint8_t hal_pin[HAL_NPORTS], hal_port[HAL_NPORTS], hal_ddr[HAL_NPORTS];
+volatile uint8_t OSCCAL, UDR0, UCSR0A, UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+volatile uint8_t TCCR0, OCR0, TIMSK, TCCR1B;
+volatile uint8_t EICRA, EICRB, EIMSK, EIFR, EECR, MCUCSR;
+uint8_t hal_eeprom[E2END + 1] = { [0 ... E2END] = 0xFF };
+uint8_t hal_ram[RAMEND + 1] = { [0 ... RAMEND] = HAL_RAM_PAINT };
+
+/// Receives the transmitted UART bytes, output is discarded if null
+FILE* hal_uart_tx;
+
+void hal_wait() {
+        if (UCSR0B & (1 << UDRIE)) {
+                USART0_UDRE_vect();
+                // the interrupt disables itself if nothing was sent
+                if ((UCSR0B & (1 << UDRIE)) && hal_uart_tx)
+                        fputc(UDR0, hal_uart_tx);
+        }
+        if (EECR & (1 << EERIE))
+                EE_READY_vect();
+}
+
+void hal_poll() {
+        while ((UCSR0B & (1 << UDRIE)) || (EECR & (1 << EERIE)))
+                hal_wait();
+}
+
+// Interrupts which are not used by winde.c
+#define HAL_INT_UNUSED(n) __attribute__((weak)) ISR(INT##n##_vect) {}
+HAL_INT_UNUSED(0) HAL_INT_UNUSED(1) HAL_INT_UNUSED(2) HAL_INT_UNUSED(3)
+HAL_INT_UNUSED(4) HAL_INT_UNUSED(5) HAL_INT_UNUSED(6) HAL_INT_UNUSED(7)
+
+static void (*const hal_int_vect[])(void) = {
+        INT0_vect, INT1_vect, INT2_vect, INT3_vect,
+        INT4_vect, INT5_vect, INT6_vect, INT7_vect,
+};
+
+// INT0-3 are on D0-D3, INT4-7 on E4-E7
+void hal_pin_write(uint8_t port, uint8_t value) {
+        uint8_t changed = hal_pin[port] ^ value;
+        hal_pin[port] = value;
+        for (uint8_t n = 0; n < 8; ++n) {
+                uint8_t bit = 1 << n;
+                if (!(EIMSK & bit) || !(changed & bit) || port != (n < 4 ? HAL_D : HAL_E))
+                        continue;
+                uint8_t sense = (n < 4 ? EICRA >> 2 * n : EICRB >> 2 * (n - 4)) & 3;
+                if (sense == 1 || sense == 2 + !!(value & bit) || (!sense && !(value & bit)))
+                        hal_int_vect[n]();
+        }
+}
+
+void hal_uart_rx(char c) {
+        UDR0 = c;
+        USART0_RX_vect();
+}
+
+uint16_t hal_tcnt1() {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * F_CPU + t.tv_nsec * (F_CPU / 1000000) / 1000;
+}
@@ -0,0 +1,254 @@
+/**
+ * @file
+ *
+ * Analyzer of recorded console sessions, minicom logs as well as raw
+ * captures of the serial port. The transitions are taken from the
+ * "<state> -> <state>" lines of the console log, listings of the commands
+ * 'log' and 'stats' are not counted. Transitions which are not declared in
+ * config.h and gaps, where a transition does not start in the last final
+ * state, are reported on stderr. The version banner of a cold start returns
+ * to the start state.
+ *
+ * Lines may start with a timestamp "[YYYY-MM-DD hh:mm:ss.sss]",
+ * "[hh:mm:ss.sss]" or "[seconds]", as written by minicom and grabserial.
+ * Then the time spent in each state is known as well.
+ *
+ * The output has the format of 'stats --export' for host/statsdot, see
+ * "make heat", or with -s the sequence of transitions as CSV. The log is
+ * read as a stream, the memory does not grow with its length.
+ * Usage: loganalyze [-s] [file]...
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "winde.h"
+
+#define ARRAY_SIZE(array) (sizeof (array) / sizeof (array[0]))
+#define MAX_LINE 256
+// Gaps and undeclared transitions reported, the summary counts all
+#define MAX_REPORTS 100
+
+static const char* const state_names[] = {
+#define STATE(name, attrs) #name,
+#include "generate.h"
+};
+
+static const struct {
+        uint8_t initial, final;
+} transitions[] = {
+#define TRANSITION(initial, event, final, action, attrs) { STATE_##initial, STATE_##final },
+#include "generate.h"
+};
+
+static int sequence;
+static const char* file;
+static unsigned long lineno;
+
+// Current state, -1 until the first transition or banner
+static int current = -1;
+// Time of the last timestamp and when the current state was entered, in seconds
+static double now, entered;
+static int timed;
+// Day of hh:mm:ss timestamps, counted up when the time of day wraps at midnight
+static double day, last_tod;
+
+static unsigned long transition_count[TRANSITION_COUNT], state_count[STATE_COUNT];
+static unsigned long undeclared[STATE_COUNT][STATE_COUNT];
+static double state_time[STATE_COUNT];
+static unsigned long alarm_einkuppeln, alarm_auskuppeln, livelocks, gaps, unknown, total;
+
+// Days since 1970-01-01 of a date of the Gregorian calendar
+static long days_from_civil(long y, unsigned m, unsigned d) {
+        y -= m <= 2;
+        long era = (y >= 0 ? y : y - 399) / 400;
+        unsigned yoe = y - era * 400;
+        unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+        unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return era * 146097 + (long)doe - 719468;
+}
+
+// Skips a leading timestamp and updates now
+static char* parse_time(char* line) {
+        char* end;
+        int y, mo, d, h, mi, n;
+        double s;
+        if (*line != '[' || !(end = strchr(line, ']')))
+                return line;
+        if (sscanf(line, "[%d-%d-%d %d:%d:%lf%n", &y, &mo, &d, &h, &mi, &s, &n) == 6 && line + n == end) {
+                now = days_from_civil(y, mo, d) * 86400.0 + h * 3600 + mi * 60 + s;
+        } else if (sscanf(line, "[%d:%d:%lf%n", &h, &mi, &s, &n) == 3 && line + n == end) {
+                double tod = h * 3600 + mi * 60 + s;
+                if (timed && tod < last_tod - 43200)
+                        day += 86400;
+                last_tod = tod;
+                now = day + tod;
+        } else if (sscanf(line, "[%lf%n", &s, &n) == 1 && line + n == end) {
+                now = s;
+        } else {
+                return line;
+        }
+        if (!timed)
+                entered = now;
+        timed = 1;
+        return end + 1;
+}
+
+// Index of the state name at the start of s, -1 if there is none
+static int parse_state(const char* s, const char** end) {
+        size_t n = 0;
+        while (isalnum((unsigned char)s[n]) || s[n] == '_')
+                ++n;
+        for (size_t i = 0; i < ARRAY_SIZE(state_names); ++i) {
+                if (strlen(state_names[i]) == n && !strncmp(s, state_names[i], n)) {
+                        *end = s + n;
+                        return i;
+                }
+        }
+        return -1;
+}
+
+static void enter(int state) {
+        if (current >= 0)
+                state_time[current] += now - entered;
+        current = state;
+        entered = now;
+}
+
+static void report(const char* what, int initial, int final) {
+        static unsigned long reports;
+        if (++reports <= MAX_REPORTS)
+                fprintf(stderr, "%s:%lu: %s %s -> %s\n", file, lineno, what, state_names[initial], state_names[final]);
+        if (reports == MAX_REPORTS)
+                fprintf(stderr, "%s:%lu: further reports suppressed\n", file, lineno);
+}
+
+static void transition(int initial, int final) {
+        size_t i = 0;
+        while (i < ARRAY_SIZE(transitions) &&
+               (transitions[i].initial != initial || transitions[i].final != final))
+                ++i;
+        ++total;
+        if (current >= 0 && current != initial) {
+                ++gaps;
+                report("gap before", initial, final);
+        }
+        if (i < ARRAY_SIZE(transitions)) {
+                ++transition_count[i];
+        } else {
+                ++undeclared[initial][final];
+                report("undeclared transition", initial, final);
+        }
+        if (sequence)
+                printf("%s,%lu,%.3f,%s,%s,%d\n", file, lineno, timed ? now : 0,
+                       state_names[initial], state_names[final], i < ARRAY_SIZE(transitions));
+        ++state_count[final];
+        enter(final);
+}
+
+static void analyze(char* line) {
+        line = parse_time(line);
+        while (*line == ' ')
+                ++line;
+        if (strstr(line, "Steuersoftware der Winde")) {
+                enter(STATE_start);
+                return;
+        }
+        const char* p;
+        int initial = parse_state(line, &p), final;
+        if (initial < 0) {
+                return;
+        } else if (!strncmp(p, " -> ", 4)) {
+                if ((final = parse_state(p + 4, &p)) >= 0 && !*p)
+                        transition(initial, final);
+                else
+                        ++unknown;
+        } else if (!strcmp(p, ": fehler_einkuppeln")) {
+                ++alarm_einkuppeln;
+        } else if (!strcmp(p, ": fehler_auskuppeln")) {
+                ++alarm_auskuppeln;
+        } else if (!strcmp(p, ": livelock")) {
+                ++livelocks;
+        }
+}
+
+// Splits the stream into lines, applies backspaces and drops the
+// beginning of overlong lines, e.g. binary telemetry frames
+static void read_log(FILE* fp) {
+        static char buf[65536];
+        char line[MAX_LINE];
+        size_t n = 0, len;
+        lineno = 1;
+        while ((len = fread(buf, 1, sizeof (buf), fp))) {
+                for (const char* c = buf; c < buf + len; ++c) {
+                        if (*c == '\n' || *c == '\r') {
+                                line[n] = '\0';
+                                analyze(line);
+                                n = 0;
+                                lineno += *c == '\n';
+                        } else if (*c == '\b') {
+                                n -= n > 0;
+                        } else {
+                                if (n == sizeof (line) - 1) {
+                                        n = sizeof (line) / 2;
+                                        memmove(line, line + sizeof (line) - 1 - n, n);
+                                }
+                                line[n++] = *c;
+                        }
+                }
+        }
+        line[n] = '\0';
+        analyze(line);
+}
+
+static void print_export() {
+        for (size_t i = 0; i < ARRAY_SIZE(transitions); ++i)
+                printf("transition %zu %s %s %lu\n", i, state_names[transitions[i].initial],
+                       state_names[transitions[i].final], transition_count[i]);
+        for (size_t i = 0; i < ARRAY_SIZE(state_names); ++i)
+                printf("state %zu %s %lu %.0f\n", i, state_names[i], state_count[i], state_time[i] * 1000);
+        printf("alarm fehler_einkuppeln %lu\nalarm fehler_auskuppeln %lu\n", alarm_einkuppeln, alarm_auskuppeln);
+        for (size_t i = 0; i < ARRAY_SIZE(state_names); ++i) {
+                for (size_t j = 0; j < ARRAY_SIZE(state_names); ++j) {
+                        if (undeclared[i][j])
+                                printf("undeclared %s %s %lu\n", state_names[i], state_names[j], undeclared[i][j]);
+                }
+        }
+}
+
+int main(int argc, char* argv[]) {
+        int arg = 1;
+        if (arg < argc && !strcmp(argv[arg], "-s")) {
+                sequence = 1;
+                ++arg;
+                printf("file,line,time,initial,final,declared\n");
+        }
+        do {
+                FILE* fp = stdin;
+                file = "-";
+                if (arg < argc && strcmp(argv[arg], "-")) {
+                        file = argv[arg];
+                        if (!(fp = fopen(file, "r"))) {
+                                perror(file);
+                                return 1;
+                        }
+                }
+                // each file is a session of its own
+                current = -1;
+                timed = 0;
+                read_log(fp);
+                enter(-1);
+                if (fp != stdin)
+                        fclose(fp);
+        } while (++arg < argc);
+
+        if (!sequence)
+                print_export();
+        unsigned long undeclared_total = 0;
+        for (size_t i = 0; i < ARRAY_SIZE(state_names); ++i) {
+                for (size_t j = 0; j < ARRAY_SIZE(state_names); ++j)
+                        undeclared_total += undeclared[i][j];
+        }
+        fprintf(stderr, "%lu transitions, %lu undeclared, %lu gaps, %lu unknown states, %lu livelocks\n",
+                total, undeclared_total, gaps, unknown, livelocks);
+        return 0;
+}
@@ -0,0 +1,21 @@
+/**
+ * @file
+ */
+#include "pins.h"
+
+// Each port is written at once, which raises the external interrupts
+void pins_set(const in_t* in) {
+        uint8_t pin[HAL_NPORTS];
+        for (uint8_t p = 0; p < HAL_NPORTS; ++p)
+                pin[p] = hal_pin[p];
+#define IN(name, port, bit, alias, filter, irq) \
+        pin[HAL_##port] = (pin[HAL_##port] & ~(1 << bit)) | (in->name << bit);
+#include "generate.h"
+        for (uint8_t p = 0; p < HAL_NPORTS; ++p)
+                hal_pin_write(p, pin[p]);
+}
+
+void pins_get(out_t* out) {
+#define OUT(name, port, bit, alias) out->name = (HAL_PORT(port) >> bit) & 1;
+#include "generate.h"
+}
@@ -0,0 +1,14 @@
+/**
+ * @file
+ *
+ * Access to the emulated pins by the names of config.h.
+ */
+#ifndef PINS_H
+#define PINS_H
+
+#include "winde.h"
+
+void pins_set(const in_t* in);
+void pins_get(out_t* out);
+
+#endif
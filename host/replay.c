@@ -0,0 +1,109 @@
+/**
+ * @file
+ *
+ * Replay of an input trace through the state machine of config.h.
+ * Each line of an input trace is one scan: the tick counter and the bytes
+ * of in.bitfield in hex, e.g. "1234 1a40". The output trace has a line
+ * for the first scan and for every scan which changed the state or the
+ * outputs: the tick counter, the state and the bytes of out.bitfield.
+ * Lines starting with '#' are comments.
+ *
+ * Usage: replay [input-trace]
+ *        replay -c expected-output-trace output-trace
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "winde.h"
+
+#define MAX_DIFFS 10
+
+static int parse_hex(const char* s, uint8_t* bytes, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+                unsigned b;
+                if (sscanf(s + 2 * i, "%2x", &b) != 1)
+                        return 0;
+                bytes[i] = b;
+        }
+        return 1;
+}
+
+// Returns the next line which is not a comment, 0 at the end
+static char* read_line(FILE* fp, char* line, size_t size, unsigned long* lineno) {
+        while (fgets(line, size, fp)) {
+                ++*lineno;
+                line[strcspn(line, "\r\n")] = '\0';
+                if (*line && *line != '#')
+                        return line;
+        }
+        return 0;
+}
+
+static void print_output(unsigned long ticks) {
+        printf("%lu %s ", ticks, state_str(state));
+        for (size_t i = 0; i < sizeof (out_t); ++i)
+                printf("%02x", out.bitfield[i]);
+        putchar('\n');
+}
+
+static int replay(FILE* fp, const char* name) {
+        char line[256], hex[64];
+        unsigned long lineno = 0, ticks, scans = 0;
+        uint8_t last_state = 0;
+        out_t last_out;
+        while (read_line(fp, line, sizeof (line), &lineno)) {
+                in_t sample;
+                if (sscanf(line, "%lu %63s", &ticks, hex) != 2 || strlen(hex) != 2 * sizeof (in_t) ||
+                    !parse_hex(hex, sample.bitfield, sizeof (in_t))) {
+                        fprintf(stderr, "%s:%lu: invalid sample\n", name, lineno);
+                        return 2;
+                }
+                timer_ticks = timer_now = ticks;
+                last_in = in;
+                in = sample;
+                control_step();
+                if (!scans++ || state != last_state || memcmp(&out, &last_out, sizeof (out_t)))
+                        print_output(ticks);
+                last_state = state;
+                last_out = out;
+        }
+        fprintf(stderr, "%lu scans replayed\n", scans);
+        return 0;
+}
+
+static int compare(const char* expected_name, const char* actual_name) {
+        FILE *expected = fopen(expected_name, "r"), *actual = fopen(actual_name, "r");
+        if (!expected || !actual) {
+                perror(expected ? actual_name : expected_name);
+                return 2;
+        }
+        char a[256], b[256];
+        unsigned long na = 0, nb = 0, diffs = 0;
+        for (;;) {
+                char *la = read_line(expected, a, sizeof (a), &na), *lb = read_line(actual, b, sizeof (b), &nb);
+                if (!la && !lb)
+                        break;
+                if (la && lb && !strcmp(la, lb))
+                        continue;
+                if (++diffs <= MAX_DIFFS)
+                        printf("%s:%lu: %s\n%s:%lu: %s\n", expected_name, na, la ? la : "<end>",
+                               actual_name, nb, lb ? lb : "<end>");
+        }
+        printf("%lu differences\n", diffs);
+        return !!diffs;
+}
+
+int main(int argc, char* argv[]) {
+        if (argc == 4 && !strcmp(argv[1], "-c"))
+                return compare(argv[2], argv[3]);
+        if (argc > 2 || (argc == 2 && *argv[1] == '-')) {
+                fprintf(stderr, "Usage: %s [input-trace]\n"
+                        "       %s -c expected-output-trace output-trace\n", argv[0], argv[0]);
+                return 2;
+        }
+        FILE* fp = argc == 2 ? fopen(argv[1], "r") : stdin;
+        if (!fp) {
+                perror(argv[1]);
+                return 2;
+        }
+        return replay(fp, argc == 2 ? argv[1] : "stdin");
+}
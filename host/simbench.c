@@ -0,0 +1,317 @@
+/**
+ * @file
+ *
+ * Cycle counts of the firmware functions under simavr. The AVR build runs
+ * with the stimuli of a script, each function entered at one of its symbols
+ * is timed from its first instruction up to its return. Interrupts which run
+ * in between are counted only for the ISR. The result is one CSV line per
+ * function called: calls, min, max, mean and total cycles and the time and
+ * script line of the slowest call.
+ *
+ * Script lines, times in ms since the reset:
+ *   <ms> <input> <0|1>    set the pin of an input by name or alias of config.h
+ *   <ms> uart <text>      send a line to the console, terminated by '\r'
+ *   <ms> end              stop the simulation
+ * Lines starting with '#' are comments.
+ *
+ * The symbols are the output of avr-nm for the ELF file, see "make bench"
+ * in build/Makefile.
+ *
+ * Usage: simbench [-m mcu] [-f hz] [-o csv] [-u console] elf symbols script
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_uart.h>
+
+#define ARRAY_SIZE(array) (sizeof (array) / sizeof (array[0]))
+#define MAX_FUNCS  512
+#define MAX_DEPTH  64
+#define MAX_LINES  1024
+#define FLASH_SIZE 0x20000
+
+typedef struct {
+        const char *name, *alias, *port;
+        uint8_t bit;
+} pin_t;
+
+static const pin_t pins[] = {
+#define IN(name, port, bit, alias, filter, irq) { #name, #alias, #port, bit },
+#include "generate.h"
+};
+
+// Interrupt vectors of the ATmega64 used by winde.c
+static const char* const vectors[] = {
+        [1] = "INT0_vect", [2] = "INT1_vect", [3] = "INT2_vect", [4] = "INT3_vect",
+        [5] = "INT4_vect", [6] = "INT5_vect", [7] = "INT6_vect", [8] = "INT7_vect",
+        [15] = "TIMER0_COMP_vect", [18] = "USART0_RX_vect", [19] = "USART0_UDRE_vect",
+        [22] = "EE_READY_vect",
+};
+
+typedef struct {
+        char     name[64];
+        int      isr;
+        unsigned long calls;
+        uint64_t min, max, total;
+        double   worst_ms;
+        unsigned worst_line;
+} func_t;
+
+typedef struct {
+        func_t*  func;
+        uint16_t sp;
+        uint64_t start, irq;
+        unsigned line;
+} frame_t;
+
+typedef struct {
+        uint64_t cycle;
+        unsigned lineno;
+        enum { STIM_PIN, STIM_UART, STIM_END } kind;
+        const pin_t* pin;
+        int level;
+        char text[64];
+} stim_t;
+
+static func_t funcs[MAX_FUNCS];
+static size_t nfuncs;
+// Function entered at each word of the flash
+static func_t* entry[FLASH_SIZE / 2];
+static frame_t frames[MAX_DEPTH];
+static size_t depth;
+static stim_t stims[MAX_LINES];
+static size_t nstims;
+static uint32_t frequency = 4000000;
+static FILE* console;
+
+static int read_symbols(const char* name) {
+        FILE* fp = fopen(name, "r");
+        if (!fp) {
+                perror(name);
+                return 0;
+        }
+        char line[256], sym[64], type;
+        unsigned long addr;
+        while (fgets(line, sizeof (line), fp)) {
+                unsigned n;
+                if (sscanf(line, "%lx %c %63s", &addr, &type, sym) != 3 || (type != 'T' && type != 't') ||
+                    addr >= FLASH_SIZE || entry[addr / 2] || !strcmp(sym, "main"))
+                        continue;
+                // the startup code is not called but runs through
+                int isr = sscanf(sym, "__vector_%u", &n) == 1;
+                if (!isr && !strncmp(sym, "__", 2))
+                        continue;
+                if (nfuncs == MAX_FUNCS) {
+                        fprintf(stderr, "%s: too many symbols\n", name);
+                        break;
+                }
+                func_t* f = funcs + nfuncs++;
+                f->isr = isr;
+                snprintf(f->name, sizeof (f->name), "%s",
+                         f->isr && n < ARRAY_SIZE(vectors) && vectors[n] ? vectors[n] : sym);
+                f->min = UINT64_MAX;
+                entry[addr / 2] = f;
+        }
+        fclose(fp);
+        return 1;
+}
+
+static const pin_t* find_pin(const char* name) {
+        for (size_t i = 0; i < ARRAY_SIZE(pins); ++i) {
+                if (!strcmp(pins[i].name, name) || (*pins[i].alias && !strcmp(pins[i].alias, name)))
+                        return pins + i;
+        }
+        return 0;
+}
+
+static int read_script(const char* name) {
+        FILE* fp = fopen(name, "r");
+        if (!fp) {
+                perror(name);
+                return 0;
+        }
+        char line[256], word[64];
+        unsigned lineno = 0;
+        double ms;
+        int n, ok = 1;
+        while (fgets(line, sizeof (line), fp)) {
+                ++lineno;
+                line[strcspn(line, "\r\n")] = '\0';
+                if (!*line || *line == '#')
+                        continue;
+                stim_t* s = stims + nstims;
+                if (nstims == MAX_LINES || sscanf(line, "%lf %63s %n", &ms, word, &n) != 2) {
+                        fprintf(stderr, "%s:%u: invalid line\n", name, lineno);
+                        ok = 0;
+                        break;
+                }
+                s->cycle = ms * frequency / 1000;
+                s->lineno = lineno;
+                if (!strcmp(word, "uart")) {
+                        s->kind = STIM_UART;
+                        snprintf(s->text, sizeof (s->text), "%s\r", line + n);
+                } else if (!strcmp(word, "end")) {
+                        s->kind = STIM_END;
+                } else if ((s->pin = find_pin(word)) && sscanf(line + n, "%d", &s->level) == 1) {
+                        s->kind = STIM_PIN;
+                } else {
+                        fprintf(stderr, "%s:%u: unknown input %s\n", name, lineno, word);
+                        ok = 0;
+                        break;
+                }
+                if (nstims && s->cycle < s[-1].cycle) {
+                        fprintf(stderr, "%s:%u: time goes backwards\n", name, lineno);
+                        ok = 0;
+                        break;
+                }
+                ++nstims;
+        }
+        fclose(fp);
+        return ok;
+}
+
+static void uart_output(struct avr_irq_t* irq, uint32_t value, void* param) {
+        if (console)
+                fputc(value, console);
+}
+
+static void pop(avr_t* avr) {
+        frame_t* fr = frames + --depth;
+        uint64_t cycles = avr->cycle - fr->start;
+        func_t* f = fr->func;
+        if (f->isr) {
+                for (size_t i = 0; i < depth; ++i)
+                        frames[i].irq += cycles;
+        }
+        cycles -= fr->irq;
+        ++f->calls;
+        f->total += cycles;
+        if (cycles < f->min)
+                f->min = cycles;
+        if (cycles >= f->max) {
+                f->max = cycles;
+                f->worst_ms = fr->start * 1000.0 / frequency;
+                f->worst_line = fr->line;
+        }
+}
+
+static void print_csv(FILE* fp) {
+        fprintf(fp, "function,calls,min,max,mean,total,worst_ms,worst_line\n");
+        for (size_t i = 0; i < nfuncs; ++i) {
+                const func_t* f = funcs + i;
+                if (f->calls)
+                        fprintf(fp, "%s,%lu,%llu,%llu,%.1f,%llu,%.3f,%u\n", f->name, f->calls,
+                                (unsigned long long)f->min, (unsigned long long)f->max,
+                                (double)f->total / f->calls, (unsigned long long)f->total,
+                                f->worst_ms, f->worst_line);
+        }
+}
+
+static int usage(const char* name) {
+        fprintf(stderr, "Usage: %s [-m mcu] [-f hz] [-o csv] [-u console] elf symbols script\n", name);
+        return 2;
+}
+
+int main(int argc, char* argv[]) {
+        const char *mcu = "atmega128", *csv = 0;
+        int opt;
+        while ((opt = getopt(argc, argv, "m:f:o:u:")) != -1) {
+                switch (opt) {
+                case 'm': mcu = optarg; break;
+                case 'f': frequency = strtoul(optarg, 0, 0); break;
+                case 'o': csv = optarg; break;
+                case 'u':
+                        if (!(console = fopen(optarg, "w"))) {
+                                perror(optarg);
+                                return 2;
+                        }
+                        break;
+                default:
+                        return usage(argv[0]);
+                }
+        }
+        if (argc - optind != 3)
+                return usage(argv[0]);
+        if (!read_symbols(argv[optind + 1]) || !read_script(argv[optind + 2]))
+                return 2;
+
+        // simavr has no ATmega64, the ATmega128 has the same registers and vectors
+        elf_firmware_t firmware = { };
+        if (elf_read_firmware(argv[optind], &firmware)) {
+                fprintf(stderr, "%s: cannot read firmware\n", argv[optind]);
+                return 2;
+        }
+        snprintf(firmware.mmcu, sizeof (firmware.mmcu), "%s", mcu);
+        firmware.frequency = frequency;
+        avr_t* avr = avr_make_mcu_by_name(mcu);
+        if (!avr) {
+                fprintf(stderr, "%s: unknown mcu\n", mcu);
+                return 2;
+        }
+        avr_init(avr);
+        avr_load_firmware(avr, &firmware);
+
+        uint32_t flags = 0;
+        avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+        flags &= ~AVR_UART_FLAG_STDIO;
+        avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+        avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_OUTPUT),
+                                uart_output, 0);
+        avr_irq_t* uart_input = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('0'), UART_IRQ_INPUT);
+
+        size_t next = 0;
+        unsigned line = 0;
+        for (;;) {
+                for (; next < nstims && avr->cycle >= stims[next].cycle; ++next) {
+                        const stim_t* s = stims + next;
+                        line = s->lineno;
+                        if (s->kind == STIM_END)
+                                goto done;
+                        if (s->kind == STIM_PIN) {
+                                avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(s->pin->port[0]),
+                                                            s->pin->bit), !!s->level);
+                        } else {
+                                for (const char* c = s->text; *c; ++c)
+                                        avr_raise_irq(uart_input, (uint8_t)*c);
+                        }
+                }
+                int cpu = avr_run(avr);
+                if (cpu == cpu_Done || cpu == cpu_Crashed) {
+                        fprintf(stderr, "%s: simulation stopped at pc 0x%x\n", argv[optind], avr->pc);
+                        break;
+                }
+
+                // a function returned once the stack is above its return address
+                uint16_t sp = avr->data[R_SPL] | avr->data[R_SPH] << 8;
+                while (depth && sp > frames[depth - 1].sp)
+                        pop(avr);
+                func_t* f = avr->pc < FLASH_SIZE ? entry[avr->pc / 2] : 0;
+                if (f && !(depth && frames[depth - 1].func == f && frames[depth - 1].sp == sp)) {
+                        if (depth == MAX_DEPTH) {
+                                fprintf(stderr, "%s: call depth exceeded at pc 0x%x\n", argv[optind], avr->pc);
+                                return 1;
+                        }
+                        frames[depth++] = (frame_t){ f, sp, avr->cycle, 0, line };
+                }
+        }
+done:
+        if (csv) {
+                FILE* fp = fopen(csv, "w");
+                if (!fp) {
+                        perror(csv);
+                        return 2;
+                }
+                print_csv(fp);
+                fclose(fp);
+        } else {
+                print_csv(stdout);
+        }
+        if (console)
+                fclose(console);
+        return 0;
+}
@@ -0,0 +1,387 @@
+/**
+ * @file
+ *
+ * Exhaustive check of the state machine of config.h in automatic mode.
+ * Starting at reset, every combination of the inputs is applied to every
+ * reachable configuration of state, flags, outputs and previous inputs.
+ * Reports violated INVARIANTs and livelocks of the transition chains
+ * (CHAIN_DEPTH > 1) with an input trace for host/replay, the unreachable
+ * states and the transitions which are never taken.
+ *
+ * Only the inputs of last_in read by RISING_EDGE are part of a
+ * configuration. They are recorded by the RISING_EDGE of statecheck.h
+ * and the search restarts if a new one shows up. Timers are not part of a
+ * configuration either: once AFTER or TIMER_EXPIRED is used, an additional
+ * input lets all timers expire, such that every timing is covered.
+ *
+ * The state machine works on global variables, hence the search is split
+ * over worker processes, each level of the breadth-first search by
+ * configuration.
+ * Usage: statecheck [-j workers]
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "statecheck.h"
+#include "winde.h"
+
+#define INPUTS ((uint32_t)1 << (IN_COUNT + !!(edges & STATECHECK_TIMER)))
+
+enum {
+#define INVARIANT(name, condition) INVARIANT_##name,
+#include "generate.h"
+        INVARIANT_COUNT,
+        // pseudo invariant: no chain of transitions returns to one of its states
+        INVARIANT_livelock = INVARIANT_COUNT
+};
+
+static const char* const invariant_names[] = {
+#define INVARIANT(name, condition) #name,
+#include "generate.h"
+        "livelock"
+};
+
+static const struct {
+        unsigned line;
+        const char *initial, *event, *final;
+} transitions[] = {
+#define TRANSITION(initial, event, final, action, attrs) \
+        [CAT(TRANSITION_, __LINE__)] = { __LINE__, #initial, #event, #final },
+#include "generate.h"
+};
+
+// Configuration: last_in in bits 0-31, out in bits 32-55, state in bits 56-61,
+// flag.fehler_einkuppeln in bit 62 and flag.fehler_auskuppeln in bit 63
+typedef uint64_t node_t;
+
+_Static_assert(sizeof (in_t) <= 4 && sizeof (out_t) <= 3, "Configuration does not fit into node_t");
+_Static_assert(TRANSITION_COUNT <= 64 && STATE_COUNT <= 64, "Too many transitions or states");
+_Static_assert(IN_COUNT <= 24, "Too many inputs");
+
+typedef struct {
+        uint8_t  type, invariant;
+        uint32_t parent, input;
+        node_t   node;
+} record_t;
+
+enum { RECORD_NODE, RECORD_VIOLATION, RECORD_END };
+
+typedef struct {
+        uint64_t fired, enabled, states;
+        uint32_t edges;
+} summary_t;
+
+// Open addressing hash table of the nodes
+typedef struct {
+        node_t*   keys;
+        uint32_t* index;
+        size_t    size, count;
+} table_t;
+
+uint32_t statecheck_edges;
+uint8_t  statecheck_due;
+
+static uint32_t edges;
+static table_t visited;
+static node_t* nodes;
+static uint32_t *parents, *inputs;
+static size_t nodes_size;
+static struct {
+        int      found;
+        uint32_t parent, input;
+} violations[INVARIANT_COUNT + 1];
+
+static size_t table_slot(const table_t* t, node_t key) {
+        size_t i = (key * 0x9E3779B97F4A7C15ull) >> 32;
+        for (i &= t->size - 1; t->index[i] && t->keys[i] != key; i = (i + 1) & (t->size - 1))
+                ;
+        return i;
+}
+
+// Returns 1 if the key was inserted, 0 if it was already present
+static int table_insert(table_t* t, node_t key, uint32_t index) {
+        if (2 * (t->count + 1) > t->size) {
+                table_t n = { calloc(2 * t->size, sizeof (node_t)), calloc(2 * t->size, sizeof (uint32_t)),
+                              2 * t->size, t->count };
+                for (size_t i = 0; i < t->size; ++i) {
+                        if (t->index[i]) {
+                                size_t j = table_slot(&n, t->keys[i]);
+                                n.keys[j] = t->keys[i];
+                                n.index[j] = t->index[i];
+                        }
+                }
+                free(t->keys);
+                free(t->index);
+                *t = n;
+        }
+        size_t i = table_slot(t, key);
+        if (t->index[i])
+                return 0;
+        t->keys[i] = key;
+        t->index[i] = index + 1;
+        ++t->count;
+        return 1;
+}
+
+static int table_contains(const table_t* t, node_t key) {
+        return t->index[table_slot(t, key)] != 0;
+}
+
+static void table_init(table_t* t) {
+        free(t->keys);
+        free(t->index);
+        t->size = 1024;
+        t->count = 0;
+        t->keys = calloc(t->size, sizeof (node_t));
+        t->index = calloc(t->size, sizeof (uint32_t));
+}
+
+static void node_load(node_t n) {
+        state = n >> 56 & 0x3F;
+        memset(&flag, 0, sizeof (flag));
+        flag.fehler_einkuppeln = n >> 62 & 1;
+        flag.fehler_auskuppeln = n >> 63 & 1;
+        for (size_t i = 0; i < sizeof (in_t); ++i)
+                last_in.bitfield[i] = n >> (8 * i);
+        for (size_t i = 0; i < sizeof (out_t); ++i)
+                out.bitfield[i] = n >> (32 + 8 * i);
+}
+
+// The inputs become last_in of the next scan
+static node_t node_save() {
+        node_t n = (node_t)state << 56 | (node_t)flag.fehler_einkuppeln << 62 |
+                (node_t)flag.fehler_auskuppeln << 63;
+        for (size_t i = 0; i < sizeof (in_t); ++i)
+                n |= (node_t)(in.bitfield[i] & (uint8_t)(edges >> (8 * i))) << (8 * i);
+        for (size_t i = 0; i < sizeof (out_t); ++i)
+                n |= (node_t)out.bitfield[i] << (32 + 8 * i);
+        return n;
+}
+
+static void node_add(node_t n, uint32_t parent, uint32_t input) {
+        if (!table_insert(&visited, n, visited.count))
+                return;
+        if (visited.count > nodes_size) {
+                nodes_size = nodes_size ? 2 * nodes_size : 1024;
+                nodes = realloc(nodes, nodes_size * sizeof (node_t));
+                parents = realloc(parents, nodes_size * sizeof (uint32_t));
+                inputs = realloc(inputs, nodes_size * sizeof (uint32_t));
+        }
+        nodes[visited.count - 1] = n;
+        parents[visited.count - 1] = parent;
+        inputs[visited.count - 1] = input;
+}
+
+// Transitions whose event is true, independent of their order
+static uint64_t transitions_enabled(uint8_t state) {
+        uint64_t enabled = 0;
+#define EVENT(name, condition) uint8_t name = (condition);
+#include "generate.h"
+#define TRANSITION(initial, event, final, act, attrs) \
+        if (state == STATE_##initial && (event)) \
+                enabled |= (uint64_t)1 << CAT(TRANSITION_, __LINE__);
+#include "generate.h"
+        return enabled;
+}
+
+static void worker(size_t begin, size_t end, unsigned id, unsigned workers, FILE* fp) {
+        summary_t summary = { 0 };
+        int reported[INVARIANT_COUNT + 1] = { 0 };
+        table_t seen = { 0 };
+        table_init(&seen);
+        statecheck_edges = 0;
+
+        for (size_t j = begin + id; j < end; j += workers) {
+                for (uint32_t input = 0; input < INPUTS; ++input) {
+                        node_load(nodes[j]);
+                        uint32_t bits = input & (((uint32_t)1 << IN_COUNT) - 1);
+                        for (size_t i = 0; i < sizeof (in_t); ++i)
+                                in.bitfield[i] = bits >> (8 * i);
+                        statecheck_due = input >> IN_COUNT & 1;
+                        // the same chain of transitions as control_step
+                        uint32_t chain = 0;
+                        int livelock = 0;
+                        for (uint8_t depth = 0; depth < CHAIN_DEPTH && !livelock; ++depth) {
+                                uint8_t old_state = state;
+                                state_transition = TRANSITION_COUNT;
+                                uint8_t new_state = state_update();
+                                summary.enabled |= transitions_enabled(old_state);
+                                if (state_transition < TRANSITION_COUNT)
+                                        summary.fired |= (uint64_t)1 << state_transition;
+                                if (new_state == old_state)
+                                        break;
+                                chain |= (uint32_t)1 << old_state;
+                                summary.states |= (uint64_t)1 << new_state;
+                                state = new_state;
+                                last_in = in;
+                                livelock = CHAIN_DEPTH > 1 && (chain >> state & 1);
+                        }
+
+                        record_t r = { RECORD_VIOLATION, 0, j, input, 0 };
+#define INVARIANT(name, condition) \
+                        if (!(condition) && !reported[INVARIANT_##name]) { \
+                                reported[INVARIANT_##name] = 1; \
+                                r.invariant = INVARIANT_##name; \
+                                fwrite(&r, sizeof (r), 1, fp); \
+                        }
+                        INVARIANT(livelock, !livelock)
+#include "generate.h"
+
+                        r.type = RECORD_NODE;
+                        r.node = node_save();
+                        if (!table_contains(&visited, r.node) && table_insert(&seen, r.node, 0))
+                                fwrite(&r, sizeof (r), 1, fp);
+                }
+        }
+
+        record_t r = { RECORD_END };
+        fwrite(&r, sizeof (r), 1, fp);
+        summary.edges = statecheck_edges;
+        fwrite(&summary, sizeof (summary), 1, fp);
+        fflush(fp);
+}
+
+// Expands one level of the search, returns 0 if new edges showed up
+static int level(size_t begin, size_t end, unsigned workers, summary_t* total) {
+        FILE* fp[workers];
+        for (unsigned i = 0; i < workers; ++i) {
+                fp[i] = tmpfile();
+                if (!fp[i]) {
+                        perror("tmpfile");
+                        exit(2);
+                }
+                fflush(stdout);
+                pid_t pid = fork();
+                if (pid < 0) {
+                        perror("fork");
+                        exit(2);
+                }
+                if (!pid) {
+                        worker(begin, end, i, workers, fp[i]);
+                        _exit(0);
+                }
+        }
+        for (unsigned i = 0; i < workers; ++i) {
+                int status;
+                if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+                        fprintf(stderr, "Worker failed\n");
+                        exit(2);
+                }
+        }
+
+        int ok = 1;
+        for (unsigned i = 0; i < workers; ++i) {
+                record_t r;
+                summary_t s;
+                rewind(fp[i]);
+                while (fread(&r, sizeof (r), 1, fp[i]) == 1 && r.type != RECORD_END) {
+                        if (r.type == RECORD_NODE) {
+                                node_add(r.node, r.parent, r.input);
+                        } else if (!violations[r.invariant].found) {
+                                violations[r.invariant].found = 1;
+                                violations[r.invariant].parent = r.parent;
+                                violations[r.invariant].input = r.input;
+                        }
+                }
+                if (r.type != RECORD_END || fread(&s, sizeof (s), 1, fp[i]) != 1) {
+                        fprintf(stderr, "Truncated worker output\n");
+                        exit(2);
+                }
+                total->fired |= s.fired;
+                total->enabled |= s.enabled;
+                total->states |= s.states;
+                if (s.edges & ~edges) {
+                        edges |= s.edges;
+                        ok = 0;
+                }
+                fclose(fp[i]);
+        }
+        return ok;
+}
+
+static void print_input(unsigned step, uint32_t input) {
+        printf("%u ", step);
+        for (size_t i = 0; i < sizeof (in_t); ++i)
+                printf("%02x", (uint8_t)((input & (((uint32_t)1 << IN_COUNT) - 1)) >> (8 * i)));
+        if (input >> IN_COUNT & 1)
+                printf(" timers expire");
+        putchar('\n');
+}
+
+// Prints the inputs from reset to the node, returns the number of scans
+static unsigned print_path(uint32_t node) {
+        unsigned step = node ? print_path(parents[node]) : 0;
+        if (node)
+                print_input(step, inputs[node]);
+        return step + !!node;
+}
+
+int main(int argc, char* argv[]) {
+        long workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc == 3 && !strcmp(argv[1], "-j")) {
+                workers = strtol(argv[2], 0, 10);
+        } else if (argc != 1) {
+                fprintf(stderr, "Usage: %s [-j workers]\n", argv[0]);
+                return 2;
+        }
+        if (workers < 1)
+                workers = 1;
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        summary_t total;
+        unsigned levels;
+        int restart;
+        do {
+                restart = 0;
+                memset(&total, 0, sizeof (total));
+                memset(violations, 0, sizeof (violations));
+                table_init(&visited);
+                node_load(0);
+                node_add(0, 0, 0);
+                size_t begin = 0, end = 1;
+                for (levels = 0; begin < end && !restart; ++levels) {
+                        restart = !level(begin, end, workers, &total);
+                        begin = end;
+                        end = visited.count;
+                }
+        } while (restart);
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("# %zu configurations, %u levels, %lu inputs each, %.1f s with %ld workers\n",
+               visited.count, levels, (unsigned long)INPUTS,
+               (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, workers);
+
+        int failed = 0;
+        for (size_t i = 0; i < INVARIANT_COUNT + (CHAIN_DEPTH > 1); ++i) {
+                if (!violations[i].found) {
+                        printf("# Invariant %s holds\n", invariant_names[i]);
+                        continue;
+                }
+                failed = 1;
+                printf("# Invariant %s is violated by the input trace:\n", invariant_names[i]);
+                print_input(print_path(violations[i].parent), violations[i].input);
+        }
+
+        // also the states passed within a chain of transitions
+        total.states |= 1;
+#define STATE(name, attrs) \
+        if (!(total.states >> STATE_##name & 1)) \
+                printf("# State %s is unreachable\n", #name);
+#include "generate.h"
+
+        for (size_t i = 0; i < TRANSITION_COUNT; ++i) {
+                if (total.fired >> i & 1)
+                        continue;
+                printf("# Transition config.h:%u %s -> %s (%s) is never taken, ", transitions[i].line,
+                       transitions[i].initial, transitions[i].final, transitions[i].event);
+                if (total.enabled >> i & 1)
+                        puts("shadowed by earlier transitions");
+                else
+                        puts("the event is never true");
+        }
+        return failed;
+}
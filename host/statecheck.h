@@ -0,0 +1,26 @@
+/**
+ * @file
+ *
+ * Included before winde.c when it is compiled for host/statecheck.
+ * Records which inputs of last_in the state machine reads and whether
+ * it uses timers.
+ */
+#ifndef STATECHECK_H
+#define STATECHECK_H
+
+#include <stdint.h>
+
+extern uint32_t statecheck_edges;
+extern uint8_t  statecheck_due;
+
+// Recorded with the edges, the inputs never reach bit 31
+#define STATECHECK_TIMER ((uint32_t)1 << 31)
+
+#define RISING_EDGE(name) \
+        ((statecheck_edges |= (uint32_t)1 << IN_##name), !last_in.name && in.name)
+
+// Timers are not part of a configuration, they may expire in any scan
+#define TIMER_DUE(deadline) \
+        ((void)(deadline), (statecheck_edges |= STATECHECK_TIMER), statecheck_due)
+
+#endif
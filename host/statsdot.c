@@ -0,0 +1,160 @@
+/**
+ * @file
+ *
+ * Weights for states.dot from the output of 'stats --export' or of
+ * host/loganalyze. The console output around the export is skipped. Writes a
+ * header for "cpp -DWEIGHTS=..." of states.dot, see "make stats": the line
+ * width of a transition grows with the logarithm of its count, the line width
+ * of a state with its time. The counts and times are shown as external
+ * labels. With -c the colours of config.h are replaced by a heat map from
+ * blue to red on the same scale. Undeclared transitions found by
+ * host/loganalyze are added as dashed edges.
+ * Usage: statsdot [-c] [file]
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "winde.h"
+
+#define ARRAY_SIZE(array) (sizeof (array) / sizeof (array[0]))
+#define MAX_WIDTH 6.0
+
+static const char* const state_names[] = {
+#define STATE(name, attrs) #name,
+#include "generate.h"
+};
+
+static const struct {
+        const char *initial, *final;
+        unsigned line;
+} transitions[] = {
+#define TRANSITION(initial, event, final, action, attrs) { #initial, #final, __LINE__ },
+#include "generate.h"
+};
+
+static unsigned long transition_count[TRANSITION_COUNT], state_count[STATE_COUNT];
+static unsigned long state_ms[STATE_COUNT], alarm_einkuppeln, alarm_auskuppeln;
+static unsigned long undeclared[STATE_COUNT][STATE_COUNT];
+static int heat;
+
+static int state_index(const char* name) {
+        for (size_t i = 0; i < ARRAY_SIZE(state_names); ++i) {
+                if (!strcmp(name, state_names[i]))
+                        return i;
+        }
+        return -1;
+}
+
+// Logarithmic scale from 0 to 1
+static double scale(unsigned long n, unsigned long max) {
+        return max ? log1p(n) / log1p(max) : 0;
+}
+
+// States are filled with a light colour, the edges are drawn in colour
+static void print_attrs(unsigned long n, unsigned long max, int node) {
+        double hue = (1 - scale(n, max)) * 2 / 3;
+        printf("penwidth = %.2f, ", 1 + (MAX_WIDTH - 1) * scale(n, max));
+        if (heat && node)
+                printf("style = \"bold,filled\", fillcolor = \"%.3f 0.4 1\", ", hue);
+        else if (heat)
+                printf("color = \"%.3f 1 1\", ", hue);
+}
+
+// Returns 0 if the line is an export line which does not match config.h
+static int parse(const char* line) {
+        char a[32], b[32];
+        unsigned i;
+        unsigned long n, ms;
+        if (sscanf(line, "transition %u %31s %31s %lu", &i, a, b, &n) == 4) {
+                if (i >= TRANSITION_COUNT || strcmp(a, transitions[i].initial) ||
+                    strcmp(b, transitions[i].final))
+                        return 0;
+                transition_count[i] = n;
+        } else if (sscanf(line, "state %u %31s %lu %lu", &i, a, &n, &ms) == 4) {
+                if (i >= STATE_COUNT || strcmp(a, state_names[i]))
+                        return 0;
+                state_count[i] = n;
+                state_ms[i] = ms;
+        } else if (sscanf(line, "undeclared %31s %31s %lu", a, b, &n) == 3) {
+                int initial = state_index(a), final = state_index(b);
+                if (initial < 0 || final < 0)
+                        return 0;
+                undeclared[initial][final] = n;
+        } else if (sscanf(line, "alarm %31s %lu", a, &n) == 2) {
+                if (!strcmp(a, "fehler_einkuppeln"))
+                        alarm_einkuppeln = n;
+                else if (!strcmp(a, "fehler_auskuppeln"))
+                        alarm_auskuppeln = n;
+                else
+                        return 0;
+        }
+        return 1;
+}
+
+int main(int argc, char* argv[]) {
+        int i = 1;
+        if (i < argc && !strcmp(argv[i], "-c")) {
+                heat = 1;
+                ++i;
+        }
+        const char* name = i < argc ? argv[i] : "-";
+        FILE* fp = i < argc ? fopen(name, "r") : stdin;
+        if (!fp) {
+                perror(name);
+                return 1;
+        }
+        char line[256];
+        unsigned lineno = 0;
+        while (fgets(line, sizeof (line), fp)) {
+                ++lineno;
+                if (!parse(line)) {
+                        fprintf(stderr, "%s:%u: export does not match config.h\n", name, lineno);
+                        return 1;
+                }
+        }
+
+        unsigned long max_count = 0, max_ms = 0;
+        for (size_t i = 0; i < TRANSITION_COUNT; ++i) {
+                if (transition_count[i] > max_count)
+                        max_count = transition_count[i];
+        }
+        for (size_t i = 0; i < STATE_COUNT; ++i) {
+                for (size_t j = 0; j < STATE_COUNT; ++j) {
+                        if (undeclared[i][j] > max_count)
+                                max_count = undeclared[i][j];
+                }
+        }
+        for (size_t i = 0; i < STATE_COUNT; ++i) {
+                if (state_ms[i] > max_ms)
+                        max_ms = state_ms[i];
+        }
+
+        printf("// Generated by host/statsdot, alarms: fehler_einkuppeln %lu, fehler_auskuppeln %lu\n",
+               alarm_einkuppeln, alarm_auskuppeln);
+        printf("#define STATE_WEIGHT(name) CAT(STATE_WEIGHT_, name)\n");
+        printf("#define TRANSITION_WEIGHT(line) CAT(TRANSITION_WEIGHT_, line)\n");
+        if (heat)
+                printf("#undef COLOR\n#define COLOR(c)\n");
+        for (size_t i = 0; i < STATE_COUNT; ++i) {
+                printf("#define STATE_WEIGHT_%s ", state_names[i]);
+                print_attrs(state_ms[i], max_ms, 1);
+                printf("xlabel = \"%lux %.1fs\",\n", state_count[i], state_ms[i] / 1000.0);
+        }
+        for (size_t i = 0; i < TRANSITION_COUNT; ++i) {
+                printf("#define TRANSITION_WEIGHT_%u ", transitions[i].line);
+                print_attrs(transition_count[i], max_count, 0);
+                printf("xlabel = \"%lu\",\n", transition_count[i]);
+        }
+        printf("#define UNDECLARED_TRANSITIONS");
+        for (size_t i = 0; i < STATE_COUNT; ++i) {
+                for (size_t j = 0; j < STATE_COUNT; ++j) {
+                        if (!undeclared[i][j])
+                                continue;
+                        printf(" \\\n        %s -> %s [ style = dashed, ", state_names[i], state_names[j]);
+                        print_attrs(undeclared[i][j], max_count, 0);
+                        printf("label = \"undeclared\", xlabel = \"%lu\" ];", undeclared[i][j]);
+                }
+        }
+        putchar('\n');
+        return 0;
+}
@@ -0,0 +1,164 @@
+/**
+ * @file
+ *
+ * Decoder of the binary telemetry records sent after the command
+ * 'telemetry <ms>'. Text output of the console between the frames and
+ * corrupted frames are skipped. The output is CSV, JSON lines with -j or
+ * an input trace for host/replay with -t.
+ * Usage: teldecode [-j|-t] [file]
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "winde.h"
+
+#define ARRAY_SIZE(array) (sizeof (array) / sizeof (array[0]))
+
+static const char* const state_names[] = {
+#define STATE(name, attrs) #name,
+#include "generate.h"
+};
+
+static const char* const in_names[] = {
+#define IN(name, port, bit, alias, filter, irq) #name,
+#include "generate.h"
+};
+
+static const char* const out_names[] = {
+#define OUT(name, port, bit, alias) #name,
+#include "generate.h"
+};
+
+static int json, trace;
+static uint64_t ticks;
+static uint8_t known;
+static in_t in_rec;
+static out_t out_rec;
+static uint8_t state_rec;
+static unsigned long frames, errors;
+
+static int bit(const uint8_t* bitfield, size_t i) {
+        return (bitfield[i >> 3] >> (i & 7)) & 1;
+}
+
+static void print_csv_header() {
+        printf("ticks,state");
+        for (size_t i = 0; i < ARRAY_SIZE(in_names); ++i)
+                printf(",%s", in_names[i]);
+        for (size_t i = 0; i < ARRAY_SIZE(out_names); ++i)
+                printf(",%s", out_names[i]);
+        putchar('\n');
+}
+
+static void print_record() {
+        const char* name = state_rec < ARRAY_SIZE(state_names) ? state_names[state_rec] : "?";
+        if (trace) {
+                printf("%llu ", (unsigned long long)ticks);
+                for (size_t i = 0; i < sizeof (in_t); ++i)
+                        printf("%02x", in_rec.bitfield[i]);
+                putchar('\n');
+        } else if (json) {
+                printf("{\"ticks\":%llu,\"state\":\"%s\",\"in\":{", (unsigned long long)ticks, name);
+                for (size_t i = 0; i < ARRAY_SIZE(in_names); ++i)
+                        printf("%s\"%s\":%d", i ? "," : "", in_names[i], bit(in_rec.bitfield, i));
+                printf("},\"out\":{");
+                for (size_t i = 0; i < ARRAY_SIZE(out_names); ++i)
+                        printf("%s\"%s\":%d", i ? "," : "", out_names[i], bit(out_rec.bitfield, i));
+                printf("}}\n");
+        } else {
+                printf("%llu,%s", (unsigned long long)ticks, name);
+                for (size_t i = 0; i < ARRAY_SIZE(in_names); ++i)
+                        printf(",%d", bit(in_rec.bitfield, i));
+                for (size_t i = 0; i < ARRAY_SIZE(out_names); ++i)
+                        printf(",%d", bit(out_rec.bitfield, i));
+                putchar('\n');
+        }
+}
+
+// Returns 0 if the payload is malformed
+static int decode(const uint8_t* p, size_t n) {
+        uint8_t fields = p[0];
+        size_t size = 3 + (fields & TELEMETRY_IN ? sizeof (in_t) : 0) +
+                (fields & TELEMETRY_OUT ? sizeof (out_t) : 0) + (fields & TELEMETRY_STATE ? 1 : 0);
+        if (n != size || (fields & ~(TELEMETRY_IN | TELEMETRY_OUT | TELEMETRY_STATE)))
+                return 0;
+
+        // the tick counter wraps, records are at most one minute apart
+        uint16_t low = p[1] | p[2] << 8;
+        ticks += (uint16_t)(low - (uint16_t)ticks);
+        p += 3;
+        if (fields & TELEMETRY_IN) {
+                memcpy(&in_rec, p, sizeof (in_t));
+                p += sizeof (in_t);
+        }
+        if (fields & TELEMETRY_OUT) {
+                memcpy(&out_rec, p, sizeof (out_t));
+                p += sizeof (out_t);
+        }
+        if (fields & TELEMETRY_STATE)
+                state_rec = *p;
+        known |= fields;
+        if (known == (TELEMETRY_IN | TELEMETRY_OUT | TELEMETRY_STATE))
+                print_record();
+        return 1;
+}
+
+static size_t drop(uint8_t* buf, size_t n, size_t k) {
+        memmove(buf, buf + k, n - k);
+        return n - k;
+}
+
+// Decodes the complete frames in buf, returns the number of bytes left
+static size_t parse(uint8_t* buf, size_t n) {
+        for (;;) {
+                size_t skip = 0;
+                while (skip < n && buf[skip] != TELEMETRY_SYNC)
+                        ++skip;
+                n = drop(buf, n, skip);
+                if (n < 2)
+                        return n;
+                size_t len = buf[1];
+                if (len <= TELEMETRY_SIZE - 3) {
+                        if (n < len + 3)
+                                return n;
+                        uint8_t crc = 0;
+                        for (size_t i = 1; i < len + 2; ++i)
+                                crc = _crc8_ccitt_update(crc, buf[i]);
+                        if (crc == buf[len + 2] && decode(buf + 2, len)) {
+                                ++frames;
+                                n = drop(buf, n, len + 3);
+                                continue;
+                        }
+                }
+                // no valid frame, resynchronize after the sync byte
+                ++errors;
+                n = drop(buf, n, 1);
+        }
+}
+
+int main(int argc, char* argv[]) {
+        int i = 1;
+        if (i < argc && !strcmp(argv[i], "-j")) {
+                json = 1;
+                ++i;
+        } else if (i < argc && !strcmp(argv[i], "-t")) {
+                trace = 1;
+                ++i;
+        }
+        FILE* fp = i < argc ? fopen(argv[i], "rb") : stdin;
+        if (!fp) {
+                perror(argv[i]);
+                return 1;
+        }
+        if (!json && !trace)
+                print_csv_header();
+
+        uint8_t buf[TELEMETRY_SIZE];
+        size_t n = 0;
+        int c;
+        while ((c = fgetc(fp)) != EOF) {
+                buf[n++] = c;
+                n = parse(buf, n);
+        }
+        fprintf(stderr, "%lu frames, %lu errors\n", frames, errors);
+        return 0;
+}
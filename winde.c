@@ -2,31 +2,100 @@
  * @file
  */
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/pgmspace.h>
-#include <util/delay.h>
-#include "pp.h"
+#include "winde.h"
+#include "lookup.h"
 
 #define BAUD           19200
-#define MAX_ARGS       2
-#define RINGBUF_RXSIZE 16
+#define MAX_ARGS       12
+#define RINGBUF_RXSIZE 32
 #define RINGBUF_TXSIZE 64
 #define LINE_SIZE      80
+#define DEBOUNCE_BITS  3
+// Ticks per scan, 0 runs the main loop as fast as possible
+#ifndef SCAN_PERIOD
+#  define SCAN_PERIOD  0
+#endif
+// Cycles of Timer1 per tick
+#define TICK_CYCLES    (F_CPU / TICK_HZ)
+#define PROF_BUCKETS   8
+#define LOG_SIZE       8
+#define EELOG_QUEUE    8
+// Records read by cmd_log between two background scans
+#define EELOG_BATCH    16
+#define IRQ_SIZE       8
+// Time of uart_gets per call in cycles of Timer1
+#define RX_BUDGET      (F_CPU / 4000)
+// Fill level of the receive buffer to send XOFF and XON with UART_XONXOFF
+#define RX_XOFF        (RINGBUF_RXSIZE / 2)
+#define RX_XON         (RINGBUF_RXSIZE / 8)
+#define XON            0x11
+#define XOFF           0x13
+
+// Stages of the main loop measured by the profiler
+#define PROF_STAGES(f) f(ports_read) f(ports_debounce) f(state_update) \
+                       f(cmd_handler) f(uart_gets) f(cmd_exec) f(ports_write) \
+                       f(telemetry_send)
+#ifdef PROFILE
+#  define PROF(stage, code) do { \
+        uint16_t prof_start = TCNT1; \
+        code; \
+        prof_record(PROF_##stage, TCNT1 - prof_start); \
+} while (0)
+#else
+#  define PROF(stage, code) do { code; } while (0)
+#endif
 
 #define ARRAY_SIZE(array)      (sizeof (array) / sizeof (array[0]))
-#define RISING_EDGE(name)      (!last_in.name && in.name)
+// Duration of the faked inputs in ports_reset
+#define LATCH_RESET_MS         50
+// last_in must only be read by RISING_EDGE, host/statecheck overrides it
+#ifndef RISING_EDGE
+#  define RISING_EDGE(name)    (!last_in.name && in.name)
+#endif
 #define DEF_PSTR(name, string) static const char PSTR_##name[] PROGMEM = string;
-// inline can be commented out to check function size with avr-nm
-#define INLINE   inline
-
-typedef volatile struct {
-        uint8_t read, write, size;
-        char   buf[0];
-} ringbuf_t;
+// INLINE can be defined empty to check function size with avr-nm
+// or to time the functions one by one with host/simbench
+#ifndef INLINE
+#  define INLINE inline
+#endif
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Ring buffer with a capacity of a power of two up to 128 bytes. The indices
+// run freely and are masked on access. Only the producer changes write and
+// only the consumer changes read, so ISR and main loop need no locking.
+#define RINGBUF(name, size) \
+        _Static_assert((size) <= 128 && !((size) & ((size) - 1)), "Invalid size of " #name); \
+        struct { volatile uint8_t read, write; volatile char buf[size]; } name
+#define RINGBUF_MASK(rb)    (sizeof ((rb).buf) - 1)
+#define ringbuf_used(rb)    ((uint8_t)((rb).write - (rb).read))
+#define ringbuf_free(rb)    ((uint8_t)(sizeof ((rb).buf) - ringbuf_used(rb)))
+#define ringbuf_empty(rb)   ((rb).write == (rb).read)
+#define ringbuf_full(rb)    (!ringbuf_free(rb))
+#define ringbuf_putc(rb, c) ({ \
+        int ringbuf_c = (uint8_t)(c); \
+        if (ringbuf_full(rb)) { \
+                ringbuf_c = EOF; \
+        } else { \
+                (rb).buf[(rb).write & RINGBUF_MASK(rb)] = ringbuf_c; \
+                ++(rb).write; \
+        } \
+        ringbuf_c; \
+})
+#define ringbuf_getc(rb) ({ \
+        int ringbuf_c = EOF; \
+        if (!ringbuf_empty(rb)) { \
+                ringbuf_c = (uint8_t)(rb).buf[(rb).read & RINGBUF_MASK(rb)]; \
+                ++(rb).read; \
+        } \
+        ringbuf_c; \
+})
+// Bulk write, copies at most n bytes and returns the number of bytes copied
+#define ringbuf_write(rb, data, n) \
+        ringbuf_copy_in((rb).buf, RINGBUF_MASK(rb), &(rb).write, ringbuf_free(rb), data, n)
 
 typedef struct {
         void (*fn)(int, char*[]);
@@ -37,41 +106,156 @@ typedef struct {
         const char *name, *alias, port[2];
 } port_t;
 
+// Message of the control loop, rendered as text by log_flush
+typedef struct {
+        uint8_t event, old_state, new_state;
+} log_t;
+
+// Record of the EEPROM log, the log is a ring over the whole EEPROM.
+// seq increases by one per record, check detects records torn by a reset.
+typedef struct {
+        uint16_t seq, time;
+        uint8_t  event, old_state, new_state, check;
+} eelog_t;
+
+#define EELOG_SLOTS ((E2END + 1) / sizeof (eelog_t))
+
+// Control state saved after every scan, restored after a warm reset
+typedef struct {
+        out_t   out;
+        flag_t  flag;
+        uint8_t state, check;
+} snapshot_t;
+
+// Cause of a reset by the flags in MCUCSR, none of them is set after a jump to 0
+enum {
+        RESET_POWER_ON,
+        RESET_EXTERNAL,
+        RESET_BROWN_OUT,
+        RESET_WATCHDOG,
+        RESET_SOFTWARE,
+        RESET_COUNT
+};
+
+// Edge of an input captured by its external interrupt
+typedef struct {
+        uint16_t time;
+        uint8_t  input, level;
+} irq_event_t;
+
+// Number of the external interrupt of a pin, INT0-3 on D0-D3 and INT4-7 on
+// E4-E7. An interrupt on another pin fails to compile.
+#define IRQ_NUM_D0 0
+#define IRQ_NUM_D1 1
+#define IRQ_NUM_D2 2
+#define IRQ_NUM_D3 3
+#define IRQ_NUM_E4 4
+#define IRQ_NUM_E5 5
+#define IRQ_NUM_E6 6
+#define IRQ_NUM_E7 7
+#define IRQ_ONE_
+#define IRQ_ONE_1 + 1
+
+// Number of inputs with interrupt
+enum {
+        IRQ_COUNT = 0
+#define IN(name, port, bit, alias, filter, irq) IRQ_ONE_##irq
+#include "generate.h"
+};
+
+// Events of log_t, the transitions come first
+enum {
+        LOG_FEHLER_EINKUPPELN = TRANSITION_COUNT,
+        LOG_FEHLER_AUSKUPPELN,
+        LOG_LIVELOCK,
+        // only in the EEPROM log
+        LOG_BOOT,
+        LOG_RESTART,
+        LOG_CLEAR,
+};
+
 INLINE int   bitfield_get(const uint8_t* bitfield, size_t i);
 INLINE void  bitfield_set(uint8_t* bitfield, size_t i, uint8_t set);
 
 INLINE void  ports_init();
 void         ports_reset();
+INLINE void  ports_reset_done();
 INLINE void  ports_read();
+INLINE void  ports_debounce();
+INLINE void  irq_init();
+INLINE void  irq_apply();
 INLINE void  ports_write();
 void         ports_print(const port_t* ports, const uint8_t* bitfield, size_t n);
 
-uint8_t      state_update();
-const char*  state_str(uint8_t state);
+ALWAYS_INLINE uint8_t ports_in_mask(uint8_t p);
+ALWAYS_INLINE uint8_t ports_out_mask(uint8_t p);
+static ALWAYS_INLINE uint8_t state_transitions(uint8_t state);
+ALWAYS_INLINE void irq_sense(uint8_t n, uint8_t level);
+ALWAYS_INLINE void irq_enable(uint8_t n, uint8_t level);
+static ALWAYS_INLINE void irq_capture(uint8_t input, uint8_t level);
 
-INLINE ringbuf_t* ringbuf_init(void* buf, uint8_t size);
-INLINE int   ringbuf_full(ringbuf_t* rb);
-INLINE int   ringbuf_empty(ringbuf_t* rb);
-int          ringbuf_putc(ringbuf_t* rb, char c);
-int          ringbuf_getc(ringbuf_t* rb);
+INLINE void  timer_init();
+INLINE void  scan_wait();
+INLINE void  scan_done();
+void         scan_background();
+
+void         log_put(uint8_t event, uint8_t old_state, uint8_t new_state);
+INLINE uint8_t log_flush();
+void         log_print(uint8_t event, uint8_t old_state, uint8_t new_state);
+
+INLINE uint8_t restart_init(uint8_t mcucsr);
+INLINE void  snapshot_save();
+uint8_t      snapshot_check(const void* p, uint8_t n);
+const char*  restart_name(uint8_t cause);
+
+INLINE void  eelog_init();
+void         eelog_put(uint8_t event, uint8_t old_state, uint8_t new_state);
+uint8_t      eelog_check(const eelog_t* rec);
+void         eelog_read(uint16_t slot, eelog_t* rec);
+
+void         telemetry_send();
+
+void         prof_record(uint8_t stage, uint16_t cycles);
+
+uint8_t      ringbuf_copy_in(volatile char* buf, uint8_t mask, volatile uint8_t* write,
+                             uint8_t free, const char* data, uint8_t n);
 
 INLINE void  uart_init();
-int          uart_putchar(char c, FILE* fp);
+void         uart_write(const char* data, uint8_t n);
+void         print_char(char c);
 char*        uart_gets();
 
+void         print_P(const char* s, uint8_t width);
+void         print_str(const char* s);
+void         print_uint(uint32_t n, uint8_t width);
+void         print_hex(const uint8_t* p, uint8_t n);
+
 void         backspace();
 int          check_usage(int wrong, int argc, char* argv[]);
 int          check_manual();
 void         print_version();
-void         cmd_handler();
+void         cmd_handler(uint8_t prompt);
 INLINE void  cmd_exec(char*);
+int8_t       lookup(uint8_t kind, const char* name);
 const cmd_t* cmd_find(const char* name, cmd_t* cmd);
 void         cmd_usage(const char* name);
 void         cmd_in(int argc, char* argv[]);
 void         cmd_out(int argc, char* argv[]);
 void         cmd_on_off(int argc, char* argv[]);
+void         cmd_io(int argc, char* argv[]);
+uint8_t      parse_hex(const char* s, uint8_t* p, uint8_t n);
 void         cmd_mode(int argc, char* argv[]);
 void         cmd_reset(int argc, char* argv[]);
+void         cmd_scan(int argc, char* argv[]);
+void         cmd_telemetry(int argc, char* argv[]);
+void         cmd_log(int argc, char* argv[]);
+void         cmd_uart(int argc, char* argv[]);
+void         cmd_restarts(int argc, char* argv[]);
+void         cmd_stats(int argc, char* argv[]);
+void         cmd_mem(int argc, char* argv[]);
+void         mem_paint();
+uint8_t*     mem_stack_low();
+void         cmd_prof(int argc, char* argv[]);
 void         cmd_help(int argc, char* argv[]);
 void         cmd_version(int argc, char* argv[]);
 
@@ -82,42 +266,13 @@ void         cmd_version(int argc, char* argv[]);
 #define OUT(name, port, bit, alias) \
         DEF_PSTR(out_##name##_name, #name) \
         IF_EMPTY(alias,, DEF_PSTR(out_##name##_alias, #alias))
-#define IN(name, port, bit, alias) \
+#define IN(name, port, bit, alias, filter, irq) \
         DEF_PSTR(in_##name##_name, #name) \
         IF_EMPTY(alias,, DEF_PSTR(in_##name##_alias, #alias))
 #include "generate.h"
 
-enum {
-#define STATE(name, attrs) STATE_##name,
-#include "generate.h"
-};
-
-typedef union {
-        struct {
-#define IN(name, port, bit, alias) uint8_t name  : 1;
-#include "generate.h"
-        };
-        struct {
-#define IN(name, port, bit, alias) uint8_t alias : 1;
-#include "generate.h"
-        };
-        uint8_t bitfield[0];
-} in_t;
-
-typedef union {
-        struct {
-#define OUT(name, port, bit, alias) uint8_t name  : 1;
-#include "generate.h"
-        };
-        struct {
-#define OUT(name, port, bit, alias) uint8_t alias : 1;
-#include "generate.h"
-        };
-        uint8_t bitfield[0];
-} out_t;
-
 const port_t PROGMEM in_list[] = {
-#define IN(name, port, bit, alias) \
+#define IN(name, port, bit, alias, filter, irq) \
         { PSTR_in_##name##_name, IF_EMPTY(alias, 0, PSTR_in_##name##_alias), #port#bit },
 #include "generate.h"
 };
@@ -133,45 +288,324 @@ const cmd_t PROGMEM cmd_list[] = {
 #include "generate.h"
 };
 
-ringbuf_t *uart_rxbuf, *uart_txbuf;
+const uint8_t PROGMEM lookup_table[LOOKUP_SIZE] = { LOOKUP_TABLE };
 
-in_t  in, last_in;
-out_t out;
+// Initial and final state of each transition
+const uint8_t PROGMEM transition_states[TRANSITION_COUNT][2] = {
+#define TRANSITION(initial, event, final, action, attrs) { STATE_##initial, STATE_##final },
+#include "generate.h"
+};
+
+RINGBUF(uart_rxbuf, RINGBUF_RXSIZE);
+RINGBUF(uart_txbuf, RINGBUF_TXSIZE);
+
+// Receive errors counted by the RX interrupt, dropped bytes found the buffer full
+struct {
+        volatile uint16_t overrun, frame, dropped;
+#ifdef UART_XONXOFF
+        // flow control character for the UDRE interrupt, nonzero while XOFF is in effect
+        volatile uint8_t flow, xoff;
+#endif
+} uart_stat;
+
+in_t   in, last_in, in_raw;
+out_t  out;
+flag_t flag;
+
+uint8_t state = 0, state_transition;
+
+// Kept in memory over resets, valid if the check matches. The counters start
+// at power-on, a warm restart continues with the snapshot.
+snapshot_t snapshot HAL_NOINIT;
+struct {
+        uint16_t count[RESET_COUNT];
+        uint8_t  check;
+} restarts HAL_NOINIT;
+uint8_t restart_cause, restart_warm;
+
+volatile uint32_t timer_ticks;
+uint32_t timer_now, state_entered;
+uint32_t timer_deadline[TIMER_COUNT];
+uint16_t timer_running;
+_Static_assert(TIMER_COUNT <= 16, "Too many timers");
+// Timer1 value at the last tick
+volatile uint16_t timer_tick_cycles;
+
+// Timing of the scan cycle in cycles of Timer1
+struct {
+        uint32_t count, next;
+        uint16_t start, start_ticks;
+        uint16_t min, max, latency_min, latency_max, overruns;
+} scan_stat;
+
+#ifdef PROFILE
+enum {
+#define PROF_ENUM(stage) PROF_##stage,
+        PROF_STAGES(PROF_ENUM)
+#undef PROF_ENUM
+        PROF_COUNT
+};
+
+#define PROF_NAME(stage) DEF_PSTR(prof_##stage, #stage)
+PROF_STAGES(PROF_NAME)
+#undef PROF_NAME
+
+const char* const prof_name[] PROGMEM = {
+#define PROF_NAME(stage) PSTR_prof_##stage,
+        PROF_STAGES(PROF_NAME)
+#undef PROF_NAME
+};
+
+// Cycles per stage, the histogram buckets grow by a factor of 4
+struct {
+        uint16_t min, max;
+        uint32_t count, sum;
+        uint16_t hist[PROF_BUCKETS];
+} prof_stat[PROF_COUNT];
+#endif
+
+// Counters since power-on or "stats --reset", they stop at the maximum.
+// The ticks of a state are added when it is left, last is the tick of that.
+struct {
+        uint16_t transition[TRANSITION_COUNT], entered[STATE_COUNT];
+        uint16_t fehler_einkuppeln, fehler_auskuppeln;
+        uint32_t ticks[STATE_COUNT], last;
+} stats;
+#define STATS_COUNT(n) do { if ((n) != UINT16_MAX) ++(n); } while (0)
+
+// The queues below are indexed with & (size - 1) like the ring buffers
+_Static_assert(LOG_SIZE <= 128 && !(LOG_SIZE & (LOG_SIZE - 1)), "Invalid LOG_SIZE");
+_Static_assert(IRQ_SIZE <= 128 && !(IRQ_SIZE & (IRQ_SIZE - 1)), "Invalid IRQ_SIZE");
+_Static_assert(EELOG_QUEUE <= 128 && !(EELOG_QUEUE & (EELOG_QUEUE - 1)), "Invalid EELOG_QUEUE");
+
+// Queue of messages, written and read only by the main loop
+struct {
+        log_t   buf[LOG_SIZE];
+        uint8_t read, write;
+        uint16_t dropped;
+} log_queue;
 
+// Edges captured by the interrupts, written by the ISRs and read by the main loop
 struct {
-        uint8_t manual            : 1;
-        uint8_t prompt_active     : 1;
-        uint8_t fehler_einkuppeln : 1;
-        uint8_t fehler_auskuppeln : 1;
-} flag;
+        volatile irq_event_t buf[IRQ_SIZE];
+        volatile uint8_t     read, write, dropped;
+} irq_queue;
+#define irq_pending() (irq_queue.read != irq_queue.write)
 
-uint8_t state = 0;
+// Records waiting for the EEPROM, written byte by byte by the EE_READY interrupt
+struct {
+        volatile eelog_t buf[EELOG_QUEUE];
+        volatile uint8_t read, write, pos;
+        volatile uint16_t slot;
+        uint16_t seq;
+        uint8_t  dropped;
+} eelog;
+
+// Reaction time from the first edge taken over to ports_write in cycles of Timer1
+struct {
+        uint16_t edge, latency_max, events;
+        uint8_t  pending;
+} irq_stat;
+
+// Longest state name including the terminating zero
+typedef union {
+#define STATE(name, attrs) char name[sizeof (#name)];
+#include "generate.h"
+} state_name_t;
+
+// Free space in the UART buffer needed to print one message
+#define LOG_TEXT_SIZE (2 * sizeof (state_name_t) + 8)
+
+// Telemetry leaves room for one message, so the log is never starved
+_Static_assert(TELEMETRY_SIZE + LOG_TEXT_SIZE <= RINGBUF_TXSIZE, "UART buffer too small for telemetry");
+// Shortest telemetry period, the frames take at most half of the baud rate
+#define TELEMETRY_MIN_MS ((2 * 10 * 1000UL * TELEMETRY_SIZE + BAUD - 1) / BAUD)
+
+_Static_assert(CHAIN_DEPTH >= 1 && (CHAIN_DEPTH == 1 || STATE_COUNT <= 32), "Invalid CHAIN_DEPTH");
+
+// Last values sent by telemetry_send, period in ticks
+struct {
+        uint16_t period, last;
+        uint8_t  count;
+        in_t     in;
+        out_t    out;
+        uint8_t  state;
+} telemetry;
+
+// Last value written to the outputs of each port
+uint8_t ports_shadow[HAL_NPORTS];
+
+// Vertical counters of the input filter, one bit plane per counter bit
+uint8_t debounce_count[DEBOUNCE_BITS][sizeof (in_t)];
+// Low byte of the tick of the last filter sample
+uint8_t debounce_tick;
+
+#define DEBOUNCE_FILTER(filter) IF_EMPTY(filter, 1, filter)
+#define IN(name, port, bit, alias, filter, irq) \
+        _Static_assert(DEBOUNCE_FILTER(filter) >= 1 && DEBOUNCE_FILTER(filter) <= (1 << DEBOUNCE_BITS), \
+                       "Invalid filter of input " #name);
+#include "generate.h"
+
+// Counter start values (filter - 1), bit plane j
+#define DEBOUNCE_RELOAD(filter, j) ((DEBOUNCE_FILTER(filter) - 1) >> j & 1)
+_Static_assert(DEBOUNCE_BITS == 3, "debounce_reload lists three bit planes");
+const in_t debounce_reload[DEBOUNCE_BITS] = {
+        {{
+#define IN(name, port, bit, alias, filter, irq) .name = DEBOUNCE_RELOAD(filter, 0),
+#include "generate.h"
+        }},
+        {{
+#define IN(name, port, bit, alias, filter, irq) .name = DEBOUNCE_RELOAD(filter, 1),
+#include "generate.h"
+        }},
+        {{
+#define IN(name, port, bit, alias, filter, irq) .name = DEBOUNCE_RELOAD(filter, 2),
+#include "generate.h"
+        }},
+};
 
 #define ACTION(name, code) INLINE void action_##name() { code }
 #include "generate.h"
 
+#ifndef HAL_HOST
 int main() {
+        winde_init();
+        for (;;) {
+                scan_wait();
+                winde_scan();
+                scan_done();
+        }
+        return 0;
+}
+#endif
+
+void winde_init() {
+        uint8_t mcucsr = MCUCSR;
+        MCUCSR = 0;
         OSCCAL = 0xA1;
+        timer_init();
         ports_init();
+        // outputs first, the EEPROM scan of eelog_init takes a while
+        if (!restart_init(mcucsr))
+                ports_reset();
         uart_init();
+        eelog_init();
+        // after the outputs, a warm restart must not wait for it
+        mem_paint();
         sei();
-        print_version();
-        for (;;) {
-                ports_read();
-                uint8_t new_state = state_update();
-                if (new_state != state) {
-                        if (flag.prompt_active) {
-                                putchar('\n');
-                                flag.prompt_active = 0;
-                        }
-                        printf_P(PSTR("%S -> %S\n"), state_str(state), state_str(new_state));
-                        state = new_state;
-                } else {
-                        cmd_handler();
+        if (restart_warm) {
+                print_P(PSTR("\nRestart after reset by "), 0);
+                print_P(restart_name(restart_cause), 0);
+                print_char('\n');
+        } else {
+                print_version();
+        }
+}
+
+// Counts the reset and restores the snapshot unless power was lost or the reset was
+// external. The inputs are taken as they are without debouncing, else the transitions
+// would see them as released. Returns 0 for a cold start.
+INLINE uint8_t restart_init(uint8_t mcucsr) {
+        restart_cause = mcucsr & (1 << PORF)  ? RESET_POWER_ON :
+                        mcucsr & ((1 << EXTRF) | (1 << JTRF)) ? RESET_EXTERNAL :
+                        mcucsr & (1 << BORF)  ? RESET_BROWN_OUT :
+                        mcucsr & (1 << WDRF)  ? RESET_WATCHDOG : RESET_SOFTWARE;
+        if (restart_cause == RESET_POWER_ON ||
+            snapshot_check(&restarts, offsetof(typeof(restarts), check)) != restarts.check)
+                memset(&restarts, 0, sizeof (restarts));
+        ++restarts.count[restart_cause];
+        restarts.check = snapshot_check(&restarts, offsetof(typeof(restarts), check));
+
+        if (restart_cause <= RESET_EXTERNAL || snapshot.flag.latch_reset ||
+            snapshot_check(&snapshot, offsetof(snapshot_t, check)) != snapshot.check)
+                return 0;
+        state = snapshot.state;
+        out = snapshot.out;
+        flag.manual = snapshot.flag.manual;
+        flag.fehler_einkuppeln = snapshot.flag.fehler_einkuppeln;
+        flag.fehler_auskuppeln = snapshot.flag.fehler_auskuppeln;
+        flag.ports_dirty = 1;
+        ports_read();
+        in = last_in = in_raw;
+        ports_write();
+        restart_warm = 1;
+        return 1;
+}
+
+INLINE void snapshot_save() {
+        snapshot.state = state;
+        snapshot.out = out;
+        snapshot.flag = flag;
+        snapshot.check = snapshot_check(&snapshot, offsetof(snapshot_t, check));
+}
+
+// CRC-8, inverted to reject memory cleared to zero
+uint8_t snapshot_check(const void* p, uint8_t n) {
+        uint8_t crc = 0;
+        for (const uint8_t* b = p; n; --n)
+                crc = _crc8_ccitt_update(crc, *b++);
+        return ~crc;
+}
+
+void winde_scan() {
+        control_scan();
+        // the prompt is printed after all pending messages, the input is
+        // read anyway so that a command always gets through
+        uint8_t pending = log_flush();
+        PROF(cmd_handler, cmd_handler(!pending));
+}
+
+// Everything which drives the outputs, never waits for the UART
+void control_scan() {
+        timer_now = timer_get();
+        if (flag.latch_reset)
+                ports_reset_done();
+        PROF(ports_read, ports_read());
+        PROF(ports_debounce, ports_debounce());
+        control_step();
+        PROF(ports_write, ports_write());
+        if (IRQ_COUNT && irq_stat.pending) {
+                uint16_t latency = TCNT1 - irq_stat.edge;
+                if (latency > irq_stat.latency_max)
+                        irq_stat.latency_max = latency;
+                irq_stat.pending = 0;
+        }
+        if (flag.telemetry)
+                PROF(telemetry_send, telemetry_send());
+        snapshot_save();
+}
+
+// Advances the state machine with the current inputs, without port access.
+// With CHAIN_DEPTH > 1 the transitions are applied until the state is
+// stable, a chain which returns to one of its states is a livelock.
+void control_step() {
+        uint32_t visited = 0;
+        for (uint8_t depth = 0; depth < CHAIN_DEPTH; ++depth) {
+                uint8_t new_state;
+                PROF(state_update, new_state = state_update());
+                if (new_state == state)
+                        return;
+                log_put(state_transition, state, new_state);
+                STATS_COUNT(stats.transition[state_transition]);
+                visited |= (uint32_t)1 << state;
+                state_enter(new_state);
+                // the edges of the inputs only count once
+                last_in = in;
+                if (CHAIN_DEPTH > 1 && (visited >> state & 1)) {
+                        log_put(LOG_LIVELOCK, state, state);
+                        return;
                 }
-                ports_write();
         }
-        return 0;
+}
+
+// Switches the state with its statistics, the time in manual mode is not counted
+void state_enter(uint8_t new_state) {
+        if (!flag.manual)
+                stats.ticks[state] += timer_now - stats.last;
+        stats.last = timer_now;
+        STATS_COUNT(stats.entered[new_state]);
+        state = new_state;
+        state_entered = timer_now;
 }
 
 INLINE int bitfield_get(const uint8_t* bitfield, size_t i) {
@@ -186,40 +620,185 @@ INLINE void bitfield_set(uint8_t* bitfield, size_t i, uint8_t set) {
 }
 
 INLINE void ports_init() {
-        ports_reset();
+        irq_init();
 
-#define OUT(name, port, bit, alias) DDR ## port |= (1 << bit);
-#include "generate.h"
+#define PORT_INIT(port) HAL_DDR(port) |= ports_out_mask(HAL_##port);
+        HAL_PORTS(PORT_INIT)
+#undef PORT_INIT
 }
 
+// The scans continue during the latch reset, ports_reset_done ends it
 void ports_reset() {
+        if (!flag.latch_reset) {
+                // the faked inputs must not raise the interrupts
+                EIMSK = 0;
+                flag.latch_reset = 1;
+        }
+
         // Hack: Latch anschalten
         // Vorgaukeln, dass auskuppeln gedrückt und Bremse getreten wird
-        DDRD |= (1 << 7);
-        DDRE |= (1 << 6);
-        PORTD |= (1 << 7);
-        PORTE |= (1 << 6);
-        PORTB &= ~(1 << 6);
-        _delay_ms(50);
-        PORTD &= ~(1 << 7);
-        PORTE &= ~(1 << 6);
-        DDRD &= ~(1 << 7);
-        DDRE &= ~(1 << 6);
+        HAL_DDR(D) |= (1 << 7);
+        HAL_DDR(E) |= (1 << 6);
+        HAL_PORT(D) |= (1 << 7);
+        HAL_PORT(E) |= (1 << 6);
+        HAL_PORT(B) &= ~(1 << 6);
+        timer_start(TIMER_latch_reset, LATCH_RESET_MS);
 
         memset(&out, 0, sizeof (out));
+        flag.ports_dirty = 1;
+}
+
+INLINE void ports_reset_done() {
+        if (!TIMER_EXPIRED(latch_reset))
+                return;
+        HAL_PORT(D) &= ~(1 << 7);
+        HAL_PORT(E) &= ~(1 << 6);
+        HAL_DDR(D) &= ~(1 << 7);
+        HAL_DDR(E) &= ~(1 << 6);
+
+        // the edges sensed before the reset are stale
+        irq_init();
+        TIMER_STOP(latch_reset);
+        flag.latch_reset = 0;
+}
+
+// Constant masks of the configured inputs and outputs of a port
+ALWAYS_INLINE uint8_t ports_in_mask(uint8_t p) {
+        return 0
+#define IN(name, port, bit, alias, filter, irq) | (p == HAL_##port ? 1 << bit : 0)
+#include "generate.h"
+                ;
+}
+
+ALWAYS_INLINE uint8_t ports_out_mask(uint8_t p) {
+        return 0
+#define OUT(name, port, bit, alias) | (p == HAL_##port ? 1 << bit : 0)
+#include "generate.h"
+                ;
 }
 
 INLINE void ports_read() {
+        // sample each port once, all inputs of a port at the same instant
+        uint8_t pin[HAL_NPORTS];
+#define PORT_READ(port) if (ports_in_mask(HAL_##port)) pin[HAL_##port] = HAL_PIN(port);
+        HAL_PORTS(PORT_READ)
+#undef PORT_READ
+
+#define IN(name, port, bit, alias, filter, irq) in_raw.name = (pin[HAL_##port] >> bit) & 1;
+#include "generate.h"
+
+        // the inputs faked by ports_reset keep their value
+        if (flag.latch_reset) {
+                in_raw.bremse_getreten = in.bremse_getreten;
+                in_raw.schalter_auskuppeln = in.schalter_auskuppeln;
+        }
+}
+
+// A changed input is taken over after it was sampled filter times in a row.
+// Each input has a vertical counter which is reloaded while the input equals
+// the debounced value and counts down while it differs. The counters only
+// count once per tick, so the filter is in ms however fast the scans run.
+INLINE void ports_debounce() {
+        uint8_t tick = (uint8_t)timer_now != debounce_tick;
+        debounce_tick = timer_now;
         last_in = in;
-#define IN(name, port, bit, alias) in.name = (PIN ## port >> bit) & 1;
+        for (uint8_t i = 0; i < sizeof (in_t); ++i) {
+                uint8_t delta = in_raw.bitfield[i] ^ in.bitfield[i], busy = 0;
+                for (uint8_t j = 0; j < DEBOUNCE_BITS; ++j)
+                        busy |= debounce_count[j][i];
+                in.bitfield[i] ^= delta & ~busy;
+                uint8_t count = delta & busy, borrow = tick ? count : 0;
+                for (uint8_t j = 0; j < DEBOUNCE_BITS; ++j) {
+                        uint8_t c = debounce_count[j][i];
+                        debounce_count[j][i] = ((c ^ borrow) & count) | (debounce_reload[j].bitfield[i] & ~count);
+                        borrow &= ~c;
+                }
+        }
+        if (IRQ_COUNT)
+                irq_apply();
+}
+
+INLINE void irq_init() {
+#define IRQ_INIT_(name, port, bit)
+#define IRQ_INIT_1(name, port, bit) irq_enable(IRQ_NUM_##port##bit, (HAL_PIN(port) >> bit) & 1);
+#define IN(name, port, bit, alias, filter, irq) IRQ_INIT_##irq(name, port, bit)
 #include "generate.h"
 }
 
+// INT4-7 trigger on any change, INT0-3 only on one edge, which is
+// switched to the opposite edge after each change. INTn is masked while
+// its sense changes, the change may raise the flag.
+ALWAYS_INLINE void irq_sense(uint8_t n, uint8_t level) {
+        if (n < 4) {
+                uint8_t mask = EIMSK;
+                EIMSK = mask & ~(1 << n);
+                EICRA = (EICRA & ~(3 << 2 * n)) | ((level ? 2 : 3) << 2 * n);
+                EIFR = 1 << n;
+                EIMSK = mask;
+        }
+}
+
+ALWAYS_INLINE void irq_enable(uint8_t n, uint8_t level) {
+        if (n < 4)
+                irq_sense(n, level);
+        else
+                EICRB = (EICRB & ~(3 << 2 * (n - 4))) | (1 << 2 * (n - 4));
+        EIFR = 1 << n;
+        EIMSK |= 1 << n;
+}
+
+static ALWAYS_INLINE void irq_capture(uint8_t input, uint8_t level) {
+        uint8_t write = irq_queue.write;
+        if ((uint8_t)(write - irq_queue.read) >= IRQ_SIZE) {
+                if (irq_queue.dropped != 0xFF)
+                        ++irq_queue.dropped;
+                return;
+        }
+        volatile irq_event_t* e = irq_queue.buf + (write & (IRQ_SIZE - 1));
+        e->time = TCNT1;
+        e->input = input;
+        e->level = level;
+        irq_queue.write = write + 1;
+}
+
+// The first edge of each input since the last scan is taken over at once.
+// The filter of the input restarts and suppresses the bouncing.
+INLINE void irq_apply() {
+        in_t taken = { };
+        while (irq_pending()) {
+                irq_event_t e = irq_queue.buf[irq_queue.read & (IRQ_SIZE - 1)];
+                ++irq_queue.read;
+                ++irq_stat.events;
+                uint8_t i = e.input >> 3, mask = 1 << (e.input & 7);
+                if ((taken.bitfield[i] & mask) || !(in.bitfield[i] & mask) == !e.level)
+                        continue;
+                taken.bitfield[i] |= mask;
+                in.bitfield[i] ^= mask;
+                for (uint8_t j = 0; j < DEBOUNCE_BITS; ++j)
+                        debounce_count[j][i] = (debounce_count[j][i] & ~mask) |
+                                (debounce_reload[j].bitfield[i] & mask);
+                if (!irq_stat.pending) {
+                        irq_stat.edge = e.time;
+                        irq_stat.pending = 1;
+                }
+        }
+}
+
 INLINE void ports_write() {
-#define OUT(name, port, bit, alias) \
-        if (out.name) { PORT ## port |= (1 << bit); } \
-        else { PORT ## port &= ~(1 << bit); }
+        uint8_t value[HAL_NPORTS] = { 0 };
+#define OUT(name, port, bit, alias) value[HAL_##port] |= out.name << bit;
 #include "generate.h"
+
+        // write each port once and only if one of its outputs changed
+#define PORT_WRITE(port) \
+        if (ports_out_mask(HAL_##port) && \
+            (flag.ports_dirty || value[HAL_##port] != ports_shadow[HAL_##port])) { \
+                HAL_PORT(port) = (HAL_PORT(port) & ~ports_out_mask(HAL_##port)) | value[HAL_##port]; \
+                ports_shadow[HAL_##port] = value[HAL_##port]; \
+        }
+        HAL_PORTS(PORT_WRITE)
+#undef PORT_WRITE
+        flag.ports_dirty = 0;
 }
 
 const char* state_str(uint8_t state) {
@@ -230,6 +809,16 @@ const char* state_str(uint8_t state) {
         return 0;
 }
 
+const char* restart_name(uint8_t cause) {
+        switch (cause) {
+        case RESET_POWER_ON:  return PSTR("power-on");
+        case RESET_EXTERNAL:  return PSTR("external");
+        case RESET_BROWN_OUT: return PSTR("brown-out");
+        case RESET_WATCHDOG:  return PSTR("watchdog");
+        }
+        return PSTR("software");
+}
+
 uint8_t state_update() {
         if (flag.manual)
                 return state;
@@ -240,6 +829,8 @@ uint8_t state_update() {
         out.led_power = !in.motor_an;
         out.drehlampe = out.einkuppeln_links | out.einkuppeln_rechts;
 
+        flag_t last_flag = flag;
+
         if (state != STATE_bremse_getreten) {
                 if (RISING_EDGE(schalter_einkuppeln_links) || RISING_EDGE(schalter_einkuppeln_rechts))
                         flag.fehler_einkuppeln = 1;
@@ -262,20 +853,43 @@ uint8_t state_update() {
         uint8_t fehler_state = state == STATE_fehler_motor_an || state == STATE_fehler_motor_aus;
         out.buzzer = flag.fehler_einkuppeln | flag.fehler_auskuppeln | fehler_state;
 
-#define EVENT(name, condition) uint8_t name = (condition);
+        if (flag.fehler_einkuppeln && !last_flag.fehler_einkuppeln) {
+                log_put(LOG_FEHLER_EINKUPPELN, state, state);
+                STATS_COUNT(stats.fehler_einkuppeln);
+        }
+        if (flag.fehler_auskuppeln && !last_flag.fehler_auskuppeln) {
+                log_put(LOG_FEHLER_AUSKUPPELN, state, state);
+                STATS_COUNT(stats.fehler_auskuppeln);
+        }
+
+        switch (state) {
+#define STATE(name, attrs) case STATE_##name: return state_transitions(STATE_##name);
+#include "generate.h"
+        }
+        return state;
+}
+
+// Inlined with a constant state only the transitions and events of
+// this state remain, in the order of config.h
+static ALWAYS_INLINE uint8_t state_transitions(uint8_t state) {
+        // pure conjunctions of inputs are mask tests of lookup.h
+#define EVENT(name, condition) \
+        uint8_t name = IF(EVENT_LOWERED_##name, EVENT_MASK_##name, (condition));
 #include "generate.h"
 
 #define TRANSITION(initial, event, final, act, attrs) \
-        if (state == STATE_##initial && (event)) { IF_EMPTY(act,, action_##act()); return STATE_##final; }
+        if (state == STATE_##initial && (event)) { \
+                IF_EMPTY(act,, action_##act()); \
+                state_transition = CAT(TRANSITION_, __LINE__); \
+                return STATE_##final; \
+        }
 #include "generate.h"
 
         return state;
 }
 
 void backspace() {
-        putchar('\b');
-        putchar(' ');
-        putchar('\b');
+        uart_write("\b \b", 3);
 }
 
 int check_usage(int wrong, int argc, char* argv[]) {
@@ -288,23 +902,30 @@ int check_usage(int wrong, int argc, char* argv[]) {
 
 void cmd_usage(const char* name) {
         cmd_t cmd;
-        if (cmd_find(name, &cmd))
-                printf_P(PSTR("Usage: %S %S\n%S\n"), cmd.name, cmd.args, cmd.help);
+        if (cmd_find(name, &cmd)) {
+                print_P(PSTR("Usage: "), 0);
+                print_P(cmd.name, 0);
+                print_char(' ');
+                print_P(cmd.args, 0);
+                print_char('\n');
+                print_P(cmd.help, 0);
+                print_char('\n');
+        }
 }
 
 int check_manual() {
         if (!flag.manual)
-                puts_P(PSTR("Enable manual mode first with command 'mode --manual'."));
+                print_P(PSTR("Enable manual mode first with command 'mode --manual'.\n"), 0);
         return flag.manual;
 }
 
 void print_version() {
-        puts_P(PSTR("\nSteuersoftware der Winde AFK-3\n"
-                    "  Version:       " VERSION "\n"
-                    "  Git-Version:   " GIT_VERSION "\n"
-                    "  Kompiliert am: " __DATE__ " " __TIME__ "\n"
-                    "  Elektronik:    Christian 'Paule' Schreiber\n"
-                    "  Software:      Daniel 'Teilchen' Mendler\n"));
+        print_P(PSTR("\nSteuersoftware der Winde AFK-3\n"
+                     "  Version:       " VERSION "\n"
+                     "  Git-Version:   " GIT_VERSION "\n"
+                     "  Kompiliert am: " __DATE__ " " __TIME__ "\n"
+                     "  Elektronik:    Christian 'Paule' Schreiber\n"
+                     "  Software:      Daniel 'Teilchen' Mendler\n\n"), 0);
 }
 
 INLINE void cmd_exec(char* line) {
@@ -315,87 +936,182 @@ INLINE void cmd_exec(char* line) {
                 if (!(argv[argc] = strsep_P(&line, PSTR(" "))) || *argv[argc] == '\0')
                         break;
         }
+        if (argc == MAX_ARGS && line && *line) {
+                print_P(PSTR("Too many arguments\n"), 0);
+                return;
+        }
 
         if (argc > 0 && cmd_find(argv[0], &cmd))
                 cmd.fn(argc, argv);
 }
 
+// Returns the index of the name in cmd_list, in_list or out_list, -1 if not found
+int8_t lookup(uint8_t kind, const char* name) {
+        uint8_t slot = pgm_read_byte(lookup_table + lookup_hash(LOOKUP_SEED, kind, name));
+        if (slot >> 6 != kind)
+                return -1;
+        uint8_t i = slot & LOOKUP_INDEX;
+        const char* s;
+        if (kind == LOOKUP_CMD)
+                s = pgm_read_ptr(&cmd_list[i].name);
+        else if (slot & LOOKUP_ALIAS)
+                s = pgm_read_ptr(&out_list[i].alias);
+        else
+                s = pgm_read_ptr(&out_list[i].name);
+        return strcmp_P(name, s) ? -1 : i;
+}
+
 const cmd_t* cmd_find(const char* name, cmd_t* cmd) {
-        for (size_t i = 0; i < ARRAY_SIZE(cmd_list); ++i) {
+        int8_t i = lookup(LOOKUP_CMD, name);
+        if (i >= 0) {
                 memcpy_P(cmd, cmd_list + i, sizeof (cmd_t));
-                if (!strcmp_P(name, cmd->name))
-                        return cmd_list + i;
+                return cmd_list + i;
         }
-        printf_P(PSTR("Command not found: %s\n"), name);
+        print_P(PSTR("Command not found: "), 0);
+        print_str(name);
+        print_char('\n');
         return 0;
 }
 
-void cmd_handler() {
-        if (!flag.prompt_active) {
-                printf_P(PSTR("%S $ "), flag.manual ? PSTR("MANUAL") : state_str(state));
+void cmd_handler(uint8_t prompt) {
+        if (prompt && !flag.prompt_active) {
+                print_P(flag.manual ? PSTR("MANUAL") : state_str(state), 0);
+                print_P(PSTR(" $ "), 0);
                 flag.prompt_active = 1;
         }
-        char* line = uart_gets();
+        char* line;
+        PROF(uart_gets, line = uart_gets());
         if (line) {
-                cmd_exec(line);
+                PROF(cmd_exec, cmd_exec(line));
                 flag.prompt_active = 0;
         }
 }
 
 void ports_print(const port_t* port_list, const uint8_t* bitfield, size_t n) {
-        printf_P(PSTR("%-18S | %-28S | Port | Active\n"), PSTR("Name"), PSTR("Alias"));
+        print_P(PSTR("Name"), 18);
+        print_P(PSTR(" | Alias"), 31);
+        print_P(PSTR(" | Port | Active\n"), 0);
         for (size_t i = 0; i < n; ++i) {
                 port_t port;
                 memcpy_P(&port, port_list + i, sizeof (port_t));
-                printf_P(PSTR("%-18S | %-28S |   %c%c | %c\n"),
-                         port.name, port.alias ? port.alias : PSTR(""),
-                         port.port[0], port.port[1],
-                         bitfield_get(bitfield, i) ? 'X' : ' ');
+                print_P(port.name, 18);
+                print_P(PSTR(" | "), 0);
+                print_P(port.alias ? port.alias : PSTR(""), 28);
+                print_P(PSTR(" |   "), 0);
+                char active[] = { port.port[0], port.port[1], ' ', '|', ' ',
+                                  bitfield_get(bitfield, i) ? 'X' : ' ', '\r', '\n' };
+                uart_write(active, sizeof (active));
         }
-        putchar('\n');
+        print_char('\n');
 }
 
 void cmd_in(int argc, char* argv[]) {
         if (check_usage(argc != 1, argc, argv)) {
-                puts_P(PSTR("Inputs:"));
+                print_P(PSTR("Inputs:\n"), 0);
                 ports_print(in_list, in.bitfield, ARRAY_SIZE(in_list));
         }
 }
 
 void cmd_out(int argc, char* argv[]) {
         if (check_usage(argc != 1, argc, argv)) {
-                puts_P(PSTR("Outputs:"));
+                print_P(PSTR("Outputs:\n"), 0);
                 ports_print(out_list, out.bitfield, ARRAY_SIZE(out_list));
         }
 }
 
 void cmd_on_off(int argc, char* argv[]) {
         if (check_usage(argc != 2, argc, argv) && check_manual()) {
-                for (size_t i = 0; i < ARRAY_SIZE(out_list); ++i) {
-                        port_t port;
-                        memcpy_P(&port, out_list + i, sizeof (port_t));
-                        if (!strcmp_P(argv[1], port.name) ||
-                            (port.alias && !strcmp_P(argv[1], port.alias))) {
-                                bitfield_set(out.bitfield, i, !strcmp_P(argv[0], PSTR_cmd_on_name));
+                int8_t i = lookup(LOOKUP_OUT, argv[1]);
+                if (i >= 0)
+                        bitfield_set(out.bitfield, i, !strcmp_P(argv[0], PSTR_cmd_on_name));
+                else {
+                        print_P(PSTR("Output not found: "), 0);
+                        print_str(argv[1]);
+                        print_char('\n');
+                }
+        }
+}
+
+// Outputs which exist, the remaining bits of out_t are padding
+const out_t PROGMEM out_valid = {{
+#define OUT(name, port, bit, alias) .name = 1,
+#include "generate.h"
+}};
+
+// Switches all given outputs together, the next ports_write applies the
+// complete combination. Without arguments the words are printed in hex.
+void cmd_io(int argc, char* argv[]) {
+        if (!check_usage(0, argc, argv)) {
+                // nothing
+        } else if (argc == 1) {
+                print_P(PSTR("In:  "), 0);
+                print_hex(in.bitfield, sizeof (in_t));
+                print_P(PSTR("\nOut: "), 0);
+                print_hex(out.bitfield, sizeof (out_t));
+                print_char('\n');
+        } else if (check_manual()) {
+                out_t set, clear, mask;
+                memset(&set, 0, sizeof (out_t));
+                memset(&clear, 0, sizeof (out_t));
+                for (int a = 1; a < argc; ++a) {
+                        const char* name = argv[a] + 1;
+                        uint8_t* bitfield = *argv[a] == '+' ? set.bitfield :
+                                            *argv[a] == '-' ? clear.bitfield : 0;
+                        if (!bitfield) {
+                                cmd_usage(argv[0]);
                                 return;
                         }
+                        if (name[0] == '0' && name[1] == 'x') {
+                                if (!parse_hex(name + 2, mask.bitfield, sizeof (out_t))) {
+                                        print_P(PSTR("Invalid mask: "), 0);
+                                        print_str(name);
+                                        print_char('\n');
+                                        return;
+                                }
+                                for (uint8_t i = 0; i < sizeof (out_t); ++i)
+                                        bitfield[i] |= mask.bitfield[i];
+                        } else {
+                                int8_t i = lookup(LOOKUP_OUT, name);
+                                if (i < 0) {
+                                        print_P(PSTR("Output not found: "), 0);
+                                        print_str(name);
+                                        print_char('\n');
+                                        return;
+                                }
+                                bitfield_set(bitfield, i, 1);
+                        }
                 }
-                printf_P(PSTR("Output not found: %s\n"), argv[1]);
+                for (uint8_t i = 0; i < sizeof (out_t); ++i)
+                        out.bitfield[i] = ((out.bitfield[i] & ~clear.bitfield[i]) | set.bitfield[i]) &
+                                pgm_read_byte(out_valid.bitfield + i);
         }
 }
 
+// Parses exactly n bytes in hex in the order of the bitfield, returns 0 if invalid
+uint8_t parse_hex(const char* s, uint8_t* p, uint8_t n) {
+        for (uint8_t i = 0; i < 2 * n; ++i) {
+                char c = s[i] | 0x20;
+                uint8_t nibble = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : 16;
+                if (nibble > 15)
+                        return 0;
+                p[i / 2] = i & 1 ? p[i / 2] << 4 | nibble : nibble;
+        }
+        return !s[2 * n];
+}
+
 void cmd_mode(int argc, char* argv[]) {
         if (!check_usage(0, argc, argv)) {
                 // nothing
         } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--manual"))) {
+                state_enter(0);
                 flag.manual = 1;
-                state = 0;
         } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--auto"))) {
+                state_enter(0);
                 flag.manual = 0;
-                state = 0;
                 ports_reset();
         } else if (argc == 1) {
-                printf_P(PSTR("%S mode is active\n"), flag.manual ? PSTR("Manual") : PSTR("Automatic"));
+                print_P(flag.manual ? PSTR("Manual") : PSTR("Automatic"), 0);
+                print_P(PSTR(" mode is active\n"), 0);
         } else {
                 cmd_usage(argv[0]);
         }
@@ -410,13 +1126,17 @@ void cmd_help(int argc, char* argv[]) {
         if (!check_usage(0, argc, argv)) {
                 // nothing
         } else if (argc == 1) {
-                puts_P(PSTR("List of commands:"));
+                print_P(PSTR("List of commands:\n"), 0);
                 cmd_t cmd;
                 for (size_t i = 0; i < ARRAY_SIZE(cmd_list); ++i) {
                         memcpy_P(&cmd, cmd_list + i, sizeof (cmd_t));
-                        printf_P(PSTR("  %-16S %S\n"), cmd.name, cmd.help);
+                        print_P(PSTR("  "), 0);
+                        print_P(cmd.name, 16);
+                        print_char(' ');
+                        print_P(cmd.help, 0);
+                        print_char('\n');
                 }
-                putchar('\n');
+                print_char('\n');
         } else if (argc == 2) {
                 cmd_usage(argv[1]);
         } else {
@@ -424,46 +1144,628 @@ void cmd_help(int argc, char* argv[]) {
         }
 }
 
+void cmd_scan(int argc, char* argv[]) {
+        if (!check_usage(argc > 2, argc, argv)) {
+                // nothing
+        } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--reset"))) {
+                scan_stat.count = 0;
+                memset(&irq_stat, 0, sizeof (irq_stat));
+                irq_queue.dropped = 0;
+        } else if (argc == 1) {
+                print_P(PSTR("Period:   "), 0);
+                if (SCAN_PERIOD) {
+                        print_uint(SCAN_PERIOD * 1000 / TICK_HZ, 0);
+                        print_P(PSTR(" ms\n"), 0);
+                } else {
+                        print_P(PSTR("free-running\n"), 0);
+                }
+                if (scan_stat.count) {
+                        print_P(PSTR("Scans:    "), 0);
+                        print_uint(scan_stat.count, 0);
+                        print_P(PSTR("\nDuration: "), 0);
+                        print_uint(scan_stat.min / (uint16_t)(F_CPU / 1000000), 0);
+                        print_P(PSTR(" - "), 0);
+                        print_uint(scan_stat.max / (uint16_t)(F_CPU / 1000000), 0);
+                        print_P(PSTR(" us\n"), 0);
+                        if (SCAN_PERIOD) {
+                                print_P(PSTR("Latency:  "), 0);
+                                print_uint(scan_stat.latency_min / (uint16_t)(F_CPU / 1000000), 0);
+                                print_P(PSTR(" - "), 0);
+                                print_uint(scan_stat.latency_max / (uint16_t)(F_CPU / 1000000), 0);
+                                print_P(PSTR(" us\nOverruns: "), 0);
+                                print_uint(scan_stat.overruns, 0);
+                                print_char('\n');
+                        }
+                }
+                if (IRQ_COUNT) {
+                        print_P(PSTR("Edges:    "), 0);
+                        print_uint(irq_stat.events, 0);
+                        print_P(PSTR(", "), 0);
+                        print_uint(irq_queue.dropped, 0);
+                        print_P(PSTR(" dropped\nReaction: "), 0);
+                        print_uint(irq_stat.latency_max / (uint16_t)(F_CPU / 1000000), 0);
+                        print_P(PSTR(" us max\n"), 0);
+                }
+        } else {
+                cmd_usage(argv[0]);
+        }
+}
+
+void cmd_telemetry(int argc, char* argv[]) {
+        if (!check_usage(argc > 2, argc, argv)) {
+                // nothing
+        } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--off"))) {
+                flag.telemetry = 0;
+        } else if (argc == 2) {
+                char* end;
+                unsigned long ms = strtoul(argv[1], &end, 10);
+                if (*end || ms > 60000) {
+                        cmd_usage(argv[0]);
+                        return;
+                }
+                if (ms < TELEMETRY_MIN_MS) {
+                        print_P(PSTR("Minimum period is "), 0);
+                        print_uint(TELEMETRY_MIN_MS, 0);
+                        print_P(PSTR(" ms\n"), 0);
+                        return;
+                }
+                telemetry.period = ms * TICK_HZ / 1000;
+                telemetry.last = timer_get() - telemetry.period;
+                telemetry.count = 0;
+                flag.telemetry = 1;
+        } else if (flag.telemetry) {
+                print_P(PSTR("Telemetry every "), 0);
+                print_uint(telemetry.period * 1000UL / TICK_HZ, 0);
+                print_P(PSTR(" ms\n"), 0);
+        } else {
+                print_P(PSTR("Telemetry is off\n"), 0);
+        }
+}
+
+// Prints the records from the oldest up to the newest one in the EEPROM,
+// a cleared log starts after the last LOG_CLEAR record
+void cmd_log(int argc, char* argv[]) {
+        if (!check_usage(argc > 2, argc, argv)) {
+                // nothing
+        } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--clear"))) {
+                eelog_put(LOG_CLEAR, state, state);
+        } else if (argc == 1) {
+                uint16_t start, first = 0;
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                        start = eelog.slot;
+                }
+                eelog_t rec;
+                for (uint16_t i = 0; i < EELOG_SLOTS; ++i) {
+                        if (!(i % EELOG_BATCH))
+                                scan_background();
+                        eelog_read((start + i) % EELOG_SLOTS, &rec);
+                        if (eelog_check(&rec) == rec.check && rec.event == LOG_CLEAR)
+                                first = i + 1;
+                }
+                print_P(PSTR("    Seq  Time[s]  Event\n"), 0);
+                uint16_t seq = 0, count = 0;
+                for (uint16_t i = first; i < EELOG_SLOTS; ++i) {
+                        // skipped records do not reach the UART, which scans while it waits
+                        if (!(i % EELOG_BATCH))
+                                scan_background();
+                        eelog_read((start + i) % EELOG_SLOTS, &rec);
+                        // skip invalid records and records overwritten while printing
+                        if (eelog_check(&rec) != rec.check || rec.event == LOG_CLEAR ||
+                            (count && (int16_t)(rec.seq - seq) <= 0))
+                                continue;
+                        seq = rec.seq;
+                        ++count;
+                        print_uint(rec.seq, 7);
+                        print_uint(rec.time, 9);
+                        print_P(PSTR("  "), 0);
+                        log_print(rec.event, rec.old_state, rec.new_state);
+                }
+                if (eelog.dropped) {
+                        print_uint(eelog.dropped, 0);
+                        print_P(PSTR(" records dropped\n"), 0);
+                }
+        } else {
+                cmd_usage(argv[0]);
+        }
+}
+
+void cmd_uart(int argc, char* argv[]) {
+        if (!check_usage(argc > 2, argc, argv)) {
+                // nothing
+        } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--reset"))) {
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                        uart_stat.overrun = uart_stat.frame = uart_stat.dropped = 0;
+                }
+        } else if (argc == 1) {
+                uint16_t overrun, frame, dropped;
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                        overrun = uart_stat.overrun;
+                        frame = uart_stat.frame;
+                        dropped = uart_stat.dropped;
+                }
+                print_P(PSTR("Overruns: "), 0);
+                print_uint(overrun, 0);
+                print_P(PSTR("\nFraming:  "), 0);
+                print_uint(frame, 0);
+                print_P(PSTR("\nDropped:  "), 0);
+                print_uint(dropped, 0);
+#ifdef UART_XONXOFF
+                print_P(PSTR("\nFlow:     XON/XOFF\n"), 0);
+#else
+                print_P(PSTR("\nFlow:     none\n"), 0);
+#endif
+        } else {
+                cmd_usage(argv[0]);
+        }
+}
+
+void cmd_restarts(int argc, char* argv[]) {
+        if (!check_usage(argc > 2, argc, argv)) {
+                // nothing
+        } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--reset"))) {
+                memset(&restarts.count, 0, sizeof (restarts.count));
+                restarts.check = snapshot_check(&restarts, offsetof(typeof(restarts), check));
+        } else if (argc == 1) {
+                print_P(PSTR("Last:      "), 0);
+                print_P(restart_name(restart_cause), 0);
+                print_P(restart_warm ? PSTR(", warm\n") : PSTR(", cold\n"), 0);
+                for (uint8_t i = RESET_EXTERNAL; i < RESET_COUNT; ++i) {
+                        print_P(restart_name(i), 11);
+                        print_uint(restarts.count[i], 0);
+                        print_char('\n');
+                }
+        } else {
+                cmd_usage(argv[0]);
+        }
+}
+
+// The export has one line per transition, state and alarm for host/statsdot:
+//   transition <index> <initial> <final> <count>
+//   state <index> <name> <entered> <ms>
+//   alarm <name> <count>
+void cmd_stats(int argc, char* argv[]) {
+        uint8_t export = argc == 2 && !strcmp_P(argv[1], PSTR("--export"));
+        if (!check_usage(argc > 2, argc, argv)) {
+                // nothing
+        } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--reset"))) {
+                memset(&stats, 0, sizeof (stats));
+                stats.last = timer_get();
+        } else if (argc == 1 || export) {
+                // the current state counts up to now
+                uint32_t now = timer_get();
+                if (!export)
+                        print_P(PSTR("  Count  Transition\n"), 0);
+                for (uint8_t i = 0; i < TRANSITION_COUNT; ++i) {
+                        if (export) {
+                                print_P(PSTR("transition "), 0);
+                                print_uint(i, 0);
+                                print_char(' ');
+                        } else {
+                                print_uint(stats.transition[i], 7);
+                                print_P(PSTR("  "), 0);
+                        }
+                        print_P(state_str(pgm_read_byte(&transition_states[i][0])), 0);
+                        print_P(export ? PSTR(" ") : PSTR(" -> "), 0);
+                        print_P(state_str(pgm_read_byte(&transition_states[i][1])), 0);
+                        if (export) {
+                                print_char(' ');
+                                print_uint(stats.transition[i], 0);
+                        }
+                        print_char('\n');
+                }
+                if (!export)
+                        print_P(PSTR("Entered  Time[s]  State\n"), 0);
+                for (uint8_t i = 0; i < STATE_COUNT; ++i) {
+                        uint32_t ticks = stats.ticks[i] + (i == state && !flag.manual ? now - stats.last : 0);
+                        if (export) {
+                                print_P(PSTR("state "), 0);
+                                print_uint(i, 0);
+                                print_char(' ');
+                                print_P(state_str(i), 0);
+                                print_char(' ');
+                                print_uint(stats.entered[i], 0);
+                                print_char(' ');
+                                print_uint(ticks / TICK_HZ * 1000 + ticks % TICK_HZ * 1000 / TICK_HZ, 0);
+                        } else {
+                                print_uint(stats.entered[i], 7);
+                                print_uint(ticks / TICK_HZ, 9);
+                                print_P(PSTR("  "), 0);
+                                print_P(state_str(i), 0);
+                        }
+                        print_char('\n');
+                }
+                print_P(export ? PSTR("alarm fehler_einkuppeln ") : PSTR("Alarms:  fehler_einkuppeln "), 0);
+                print_uint(stats.fehler_einkuppeln, 0);
+                print_P(export ? PSTR("\nalarm fehler_auskuppeln ") : PSTR(", fehler_auskuppeln "), 0);
+                print_uint(stats.fehler_auskuppeln, 0);
+                print_char('\n');
+        } else {
+                cmd_usage(argv[0]);
+        }
+}
+
+// Static buffers reported by "mem", the line buffer is static in uart_gets
+#define MEM_BUFFERS(f) \
+        f(uart_rxbuf, sizeof (uart_rxbuf)) \
+        f(uart_txbuf, sizeof (uart_txbuf)) \
+        f(line,       LINE_SIZE)           \
+        f(log_queue,  sizeof (log_queue))  \
+        f(eelog,      sizeof (eelog))      \
+        f(irq_queue,  sizeof (irq_queue))  \
+        f(stats,      sizeof (stats))      \
+        f(snapshot,   sizeof (snapshot) + sizeof (restarts))
+
+#define MEM_NAME(name, size) DEF_PSTR(mem_##name, #name)
+MEM_BUFFERS(MEM_NAME)
+#undef MEM_NAME
+
+const struct {
+        const char* name;
+        uint16_t    size;
+} mem_buffers[] PROGMEM = {
+#define MEM_BUFFER(name, size) { PSTR_mem_##name, size },
+        MEM_BUFFERS(MEM_BUFFER)
+#undef MEM_BUFFER
+};
+
+// Paints the RAM between the static data and the stack pointer, the
+// interrupts only borrow it
+void mem_paint() {
+        uint8_t *p = hal_ram_static(), *sp = hal_sp();
+        while (p < sp)
+                *p++ = HAL_RAM_PAINT;
+}
+
+// Lowest address reached by the stack since the RAM was painted. A stack
+// which wrote the paint value itself may be found a few bytes too short.
+uint8_t* mem_stack_low() {
+        uint8_t* p = hal_ram_static();
+        while (p <= hal_ram_end() && *p == HAL_RAM_PAINT)
+                ++p;
+        return p;
+}
+
+void cmd_mem(int argc, char* argv[]) {
+        if (!check_usage(argc > 2, argc, argv)) {
+                // nothing
+        } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--reset"))) {
+                mem_paint();
+        } else if (argc == 1) {
+                uint8_t *sp = hal_sp(), *low = mem_stack_low();
+                print_P(PSTR("RAM:       "), 0);
+                print_uint(hal_ram_end() - hal_ram_start() + 1, 0);
+                print_P(PSTR(" bytes, static "), 0);
+                print_uint(hal_ram_static() - hal_ram_start(), 0);
+                print_P(PSTR(", free "), 0);
+                print_uint(sp - hal_ram_static() + 1, 0);
+                print_P(PSTR("\nStack:     now "), 0);
+                print_uint(hal_ram_end() - sp, 0);
+                print_P(PSTR(", peak "), 0);
+                print_uint(hal_ram_end() - low + 1, 0);
+                print_P(PSTR("\nHeadroom:  minimum "), 0);
+                print_uint(low - hal_ram_static(), 0);
+                print_P(PSTR("\nBuffers:\n"), 0);
+                for (uint8_t i = 0; i < sizeof (mem_buffers) / sizeof (mem_buffers[0]); ++i) {
+                        print_P(PSTR("  "), 0);
+                        print_P(pgm_read_ptr(&mem_buffers[i].name), 12);
+                        print_uint(pgm_read_word(&mem_buffers[i].size), 5);
+                        print_char('\n');
+                }
+        } else {
+                cmd_usage(argv[0]);
+        }
+}
+
+#ifdef PROFILE
+void cmd_prof(int argc, char* argv[]) {
+        if (!check_usage(argc > 2, argc, argv)) {
+                // nothing
+        } else if (argc == 2 && !strcmp_P(argv[1], PSTR("--reset"))) {
+                memset(prof_stat, 0, sizeof (prof_stat));
+        } else if (argc == 1) {
+                print_P(PSTR("Stage                 Count    Min    Max   Mean"
+                             " | Histogram <4, <16, <64, ..., >=16384 cycles\n"), 0);
+                for (uint8_t i = 0; i < PROF_COUNT; ++i) {
+                        if (!prof_stat[i].count)
+                                continue;
+                        print_P(pgm_read_ptr(prof_name + i), 16);
+                        print_uint(prof_stat[i].count, 11);
+                        print_uint(prof_stat[i].min, 7);
+                        print_uint(prof_stat[i].max, 7);
+                        print_uint(prof_stat[i].sum / prof_stat[i].count, 7);
+                        print_P(PSTR(" |"), 0);
+                        for (uint8_t j = 0; j < PROF_BUCKETS; ++j) {
+                                print_char(' ');
+                                print_uint(prof_stat[i].hist[j], 0);
+                        }
+                        print_char('\n');
+                }
+        } else {
+                cmd_usage(argv[0]);
+        }
+}
+
+void prof_record(uint8_t stage, uint16_t cycles) {
+        uint8_t bucket = 0;
+        for (uint16_t c = cycles >> 2; c && bucket < PROF_BUCKETS - 1; c >>= 2)
+                ++bucket;
+        if (!prof_stat[stage].count || cycles < prof_stat[stage].min)
+                prof_stat[stage].min = cycles;
+        if (cycles > prof_stat[stage].max)
+                prof_stat[stage].max = cycles;
+        ++prof_stat[stage].count;
+        prof_stat[stage].sum += cycles;
+        if (prof_stat[stage].hist[bucket] != 0xFFFF)
+                ++prof_stat[stage].hist[bucket];
+}
+#endif
+
 void cmd_version(int argc, char* argv[]) {
         if (check_usage(argc != 1, argc, argv))
                 print_version();
 }
 
-INLINE ringbuf_t* ringbuf_init(void* buf, uint8_t size) {
-	ringbuf_t *rb = (ringbuf_t*)buf;
-	rb->size = size - sizeof(ringbuf_t);
-	rb->read = rb->write = 0;
-	return rb;
+INLINE void timer_init() {
+        // Timer0 generates the tick, CTC mode with prescaler 32
+        OCR0 = F_CPU / 32 / TICK_HZ - 1;
+        TCCR0 = (1 << WGM01) | (1 << CS01) | (1 << CS00);
+        TIMSK |= (1 << OCIE0);
+        // Timer1 runs freely with F_CPU to measure durations
+        TCCR1B = (1 << CS10);
 }
 
-INLINE int ringbuf_full(ringbuf_t* rb) {
-        return rb->read == (rb->write + 1) % rb->size;
+void timer_start(uint8_t timer, uint16_t ms) {
+        timer_deadline[timer] = timer_now + TIMER_TICKS(ms);
+        timer_running |= (uint16_t)1 << timer;
 }
 
-INLINE int ringbuf_empty(ringbuf_t* rb) {
-        return rb->read == rb->write;
+uint32_t timer_get() {
+        uint32_t ticks;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ticks = timer_ticks;
+        }
+        return ticks;
 }
 
-int ringbuf_putc(ringbuf_t* rb, char c) {
-        if (ringbuf_full(rb))
-                return EOF;
-        rb->buf[rb->write++] = c;
-        if (rb->write == rb->size)
-                rb->write = 0;
-        return c;
+// Wait for the start of the next scan period. A scan which ended after the
+// start of the next period is counted as overrun.
+INLINE void scan_wait() {
+        uint32_t ticks = timer_get();
+        if (SCAN_PERIOD) {
+                if (scan_stat.count && (int32_t)(ticks - scan_stat.next) >= 0) {
+                        ++scan_stat.overruns;
+                        scan_stat.next = ticks;
+                } else {
+                        // an edge captured by an interrupt starts the scan at once
+                        while (!irq_pending() && (int32_t)((ticks = timer_get()) - scan_stat.next) < 0) {
+                                // wait, do nothing
+                        }
+                }
+                if ((int32_t)(ticks - scan_stat.next) >= 0)
+                        scan_stat.next += SCAN_PERIOD;
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                scan_stat.start = TCNT1;
+                scan_stat.start_ticks = ticks;
+                if (SCAN_PERIOD) {
+                        uint16_t latency = scan_stat.start - timer_tick_cycles;
+                        if (!scan_stat.count || latency < scan_stat.latency_min)
+                                scan_stat.latency_min = latency;
+                        if (!scan_stat.count || latency > scan_stat.latency_max)
+                                scan_stat.latency_max = latency;
+                }
+        }
+}
+
+INLINE void scan_done() {
+        uint16_t cycles = TCNT1 - scan_stat.start;
+        // Timer1 overflows after 65536 cycles, saturate longer scans
+        if ((uint16_t)(timer_get() - scan_stat.start_ticks) >= 0xFFFF / TICK_CYCLES)
+                cycles = 0xFFFF;
+        if (!scan_stat.count) {
+                scan_stat.min = scan_stat.max = cycles;
+                scan_stat.overruns = 0;
+        } else if (cycles < scan_stat.min) {
+                scan_stat.min = cycles;
+        } else if (cycles > scan_stat.max) {
+                scan_stat.max = cycles;
+        }
+        ++scan_stat.count;
+}
+
+// Runs the control scan while the main loop waits for the UART,
+// such that long outputs do not delay the reaction to the inputs
+void scan_background() {
+        if (SCAN_PERIOD && !irq_pending()) {
+                if ((int32_t)(timer_get() - scan_stat.next) < 0)
+                        return;
+                scan_stat.next += SCAN_PERIOD;
+        }
+        control_scan();
+}
+
+void log_put(uint8_t event, uint8_t old_state, uint8_t new_state) {
+        eelog_put(event, old_state, new_state);
+        uint8_t write = (log_queue.write + 1) & (LOG_SIZE - 1);
+        if (write == log_queue.read) {
+                ++log_queue.dropped;
+                return;
+        }
+        log_t* log = log_queue.buf + log_queue.write;
+        log->event = event;
+        log->old_state = old_state;
+        log->new_state = new_state;
+        log_queue.write = write;
+}
+
+// Prints the queued messages as long as the UART buffer has space,
+// returns nonzero if messages are left
+INLINE uint8_t log_flush() {
+        for (;;) {
+                if (log_queue.read == log_queue.write && !log_queue.dropped)
+                        return 0;
+                if (ringbuf_free(uart_txbuf) < LOG_TEXT_SIZE)
+                        return 1;
+                if (flag.prompt_active) {
+                        print_char('\n');
+                        flag.prompt_active = 0;
+                }
+                if (log_queue.dropped) {
+                        print_uint(log_queue.dropped, 0);
+                        print_P(PSTR(" messages dropped\n"), 0);
+                        log_queue.dropped = 0;
+                        continue;
+                }
+                const log_t* log = log_queue.buf + log_queue.read;
+                log_print(log->event, log->old_state, log->new_state);
+                log_queue.read = (log_queue.read + 1) & (LOG_SIZE - 1);
+        }
+}
+
+void log_print(uint8_t event, uint8_t old_state, uint8_t new_state) {
+        print_P(state_str(old_state), 0);
+        if (event < TRANSITION_COUNT) {
+                print_P(PSTR(" -> "), 0);
+                print_P(state_str(new_state), 0);
+        } else {
+                print_P(event == LOG_FEHLER_EINKUPPELN ? PSTR(": fehler_einkuppeln") :
+                        event == LOG_FEHLER_AUSKUPPELN ? PSTR(": fehler_auskuppeln") :
+                        event == LOG_LIVELOCK ? PSTR(": livelock") :
+                        event == LOG_RESTART ? PSTR(": restart") : PSTR(": boot"), 0);
+        }
+        print_char('\n');
+}
+
+// Continues the log after the record with the highest sequence number
+INLINE void eelog_init() {
+        uint8_t found = 0;
+        for (uint16_t slot = 0; slot < EELOG_SLOTS; ++slot) {
+                eelog_t rec;
+                eelog_read(slot, &rec);
+                if (eelog_check(&rec) == rec.check && (!found || (int16_t)(rec.seq - eelog.seq) > 0)) {
+                        eelog.seq = rec.seq;
+                        eelog.slot = slot;
+                        found = 1;
+                }
+        }
+        if (found) {
+                ++eelog.seq;
+                eelog.slot = (eelog.slot + 1) % EELOG_SLOTS;
+        }
+        eelog_put(restart_warm ? LOG_RESTART : LOG_BOOT, state, state);
+}
+
+// Queues a record, the EEPROM takes about 8.5 ms per byte
+void eelog_put(uint8_t event, uint8_t old_state, uint8_t new_state) {
+        uint8_t write = eelog.write;
+        if ((uint8_t)(write - eelog.read) >= EELOG_QUEUE) {
+                if (eelog.dropped < 255)
+                        ++eelog.dropped;
+                return;
+        }
+        eelog_t rec = {
+                .seq       = eelog.seq++,
+                .time      = timer_get() / TICK_HZ,
+                .event     = event,
+                .old_state = old_state,
+                .new_state = new_state,
+        };
+        rec.check = eelog_check(&rec);
+        eelog.buf[write & (EELOG_QUEUE - 1)] = rec;
+        eelog.write = write + 1;
+        EECR |= 1 << EERIE;
 }
 
-int ringbuf_getc(ringbuf_t* rb) {
-        if (ringbuf_empty(rb))
-                return EOF;
-        char c = rb->buf[rb->read++];
-        if (rb->read == rb->size)
-                rb->read = 0;
-        return c;
+// Check byte of the record, erased and zeroed records are invalid
+uint8_t eelog_check(const eelog_t* rec) {
+        const uint8_t* p = (const uint8_t*)rec;
+        uint8_t check = 0xA5;
+        for (uint8_t i = 0; i < offsetof(eelog_t, check); ++i)
+                check ^= p[i];
+        return check;
+}
+
+// Waits while the interrupt writes, the address must not change during a write
+void eelog_read(uint16_t slot, eelog_t* rec) {
+        uint8_t* p = (uint8_t*)rec;
+        for (uint8_t i = 0; i < sizeof (eelog_t);) {
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                        if (!hal_eeprom_busy()) {
+                                p[i] = hal_eeprom_read(slot * sizeof (eelog_t) + i);
+                                ++i;
+                        }
+                }
+                if (i < sizeof (eelog_t) && hal_eeprom_busy()) {
+                        hal_wait();
+                        scan_background();
+                }
+        }
+}
+
+// Sends a record if the period elapsed and the UART buffer has space for it.
+// Changes are accumulated relative to the last record, a skipped record
+// delays the change but does not lose it.
+void telemetry_send() {
+        uint16_t ticks = timer_get();
+        // pending messages go first
+        if ((uint16_t)(ticks - telemetry.last) < telemetry.period ||
+            log_queue.read != log_queue.write ||
+            ringbuf_free(uart_txbuf) < TELEMETRY_SIZE + LOG_TEXT_SIZE)
+                return;
+        telemetry.last = ticks;
+
+        uint8_t frame[TELEMETRY_SIZE], n = 2, fields = 0;
+        if (!telemetry.count)
+                fields = TELEMETRY_IN | TELEMETRY_OUT | TELEMETRY_STATE;
+        if (memcmp(&in, &telemetry.in, sizeof (in_t)))
+                fields |= TELEMETRY_IN;
+        if (memcmp(&out, &telemetry.out, sizeof (out_t)))
+                fields |= TELEMETRY_OUT;
+        if (state != telemetry.state)
+                fields |= TELEMETRY_STATE;
+        telemetry.count = (telemetry.count + 1) % TELEMETRY_FULL;
+
+        frame[n++] = fields;
+        frame[n++] = ticks;
+        frame[n++] = ticks >> 8;
+        if (fields & TELEMETRY_IN) {
+                telemetry.in = in;
+                memcpy(frame + n, &in, sizeof (in_t));
+                n += sizeof (in_t);
+        }
+        if (fields & TELEMETRY_OUT) {
+                telemetry.out = out;
+                memcpy(frame + n, &out, sizeof (out_t));
+                n += sizeof (out_t);
+        }
+        if (fields & TELEMETRY_STATE)
+                frame[n++] = telemetry.state = state;
+
+        frame[0] = TELEMETRY_SYNC;
+        frame[1] = n - 2;
+        uint8_t crc = 0;
+        for (uint8_t i = 1; i < n; ++i)
+                crc = _crc8_ccitt_update(crc, frame[i]);
+        frame[n++] = crc;
+        uart_write((const char*)frame, n);
+}
+
+// The index is published only after the data is copied
+uint8_t ringbuf_copy_in(volatile char* buf, uint8_t mask, volatile uint8_t* write,
+                        uint8_t free, const char* data, uint8_t n) {
+        if (n > free)
+                n = free;
+        uint8_t w = *write;
+        for (uint8_t i = 0; i < n; ++i)
+                buf[(w + i) & mask] = data[i];
+        *write = w + n;
+        return n;
 }
 
 void uart_init() {
+#ifndef HAL_HOST
 #include <util/setbaud.h>
+#endif
         UBRR0H = UBRRH_VALUE;
         UBRR0L = UBRRL_VALUE;
 #if USE_2X
@@ -476,82 +1778,216 @@ void uart_init() {
         UCSR0C = (1 << UCSZ1) | (1 << UCSZ0);
         // enable serial receiver and transmitter
         UCSR0B = (1 << RXEN) | (1 << TXEN) | (1 << RXCIE);
+}
 
-        static char rxbuf[RINGBUF_RXSIZE], txbuf[RINGBUF_TXSIZE];
-        uart_rxbuf = ringbuf_init(rxbuf, sizeof (rxbuf));
-        uart_txbuf = ringbuf_init(txbuf, sizeof (txbuf));
-
-        static FILE uart_stdout = FDEV_SETUP_STREAM(uart_putchar, 0, _FDEV_SETUP_WRITE);
-        stdout = &uart_stdout;
+void uart_write(const char* data, uint8_t n) {
+        for (;;) {
+                uint8_t written = ringbuf_write(uart_txbuf, data, n);
+                if (written)
+                        UCSR0B |= (1 << UDRIE);
+                if (!(n -= written))
+                        break;
+                data += written;
+                hal_wait();
+                scan_background();
+        }
 }
 
-int uart_putchar(char c, FILE* fp) {
+void print_char(char c) {
         if (c == '\n')
-                uart_putchar('\r', fp);
-        while (ringbuf_full(uart_txbuf)) {
-                // wait, do nothing
+                uart_write("\r\n", 2);
+        else
+                uart_write(&c, 1);
+}
+
+// Prints the PROGMEM string left-aligned in a field of the given width.
+// The formatter is much smaller and faster than printf_P of the avr-libc
+// and writes directly into the UART buffer.
+void print_P(const char* s, uint8_t width) {
+        char buf[16];
+        uint8_t n = 0;
+        for (;;) {
+                char c = pgm_read_byte(s);
+                if (c)
+                        ++s;
+                else if (width)
+                        c = ' ';
+                else
+                        break;
+                if (width)
+                        --width;
+                if (c == '\n')
+                        buf[n++] = '\r';
+                buf[n++] = c;
+                if (n >= sizeof (buf) - 1) {
+                        uart_write(buf, n);
+                        n = 0;
+                }
         }
-        ringbuf_putc(uart_txbuf, c);
-        UCSR0B |= (1 << UDRIE);
-        return 0;
+        uart_write(buf, n);
 }
 
+void print_str(const char* s) {
+        uart_write(s, strlen(s));
+}
+
+// Prints the number right-aligned in a field of the given width
+void print_uint(uint32_t n, uint8_t width) {
+        char buf[10];
+        uint8_t i = sizeof (buf);
+        do {
+                buf[--i] = '0' + n % 10;
+                n /= 10;
+        } while (n);
+        for (uint8_t pad = sizeof (buf) - i; pad < width; ++pad)
+                uart_write(" ", 1);
+        uart_write(buf + i, sizeof (buf) - i);
+}
+
+// Prints the bytes in hex, two digits each
+void print_hex(const uint8_t* p, uint8_t n) {
+        while (n--) {
+                char buf[2] = { "0123456789abcdef"[*p >> 4], "0123456789abcdef"[*p & 15] };
+                uart_write(buf, 2);
+                ++p;
+        }
+}
+
+// Processes the received bytes up to the end of a line or RX_BUDGET,
+// returns the line if it is complete
 char* uart_gets() {
         static char line[LINE_SIZE];
         static uint8_t size = 0;
-        int c = ringbuf_getc(uart_rxbuf);
-        switch (c) {
-        case EOF:
-                break;
-        case '\b':   // backspace deletes the last character
-        case '\x7f': // DEL
-                if (size > 0) {
-                        backspace();
-                        --size;
-                } else {
-                        putchar('\a');
-                }
-                break;
-        case '\r':
-        case '\n':
-                putchar('\n');
-                line[size] = 0;
-                size = 0;
-                return line;
-        case 'c' & 0x1F: // ^c prints newline and clears buffer
-                putchar('\n');
-                size = 0;
-                break;
-        case 'w' & 0x1F: // ^w kills the last word
-                for (; size > 0 && line[size-1] != ' '; --size)
-                        backspace();
-                break;
-        case 'u' & 0x1F: // ^u kills the entire buffer
-                for (; size > 0; --size)
-                        backspace();
-                break;
-        case '\t': // tab is replaced by space
-                c = ' ';
-                // fall through
-        default:
-                if (size + 1 < sizeof (line)) {
-                        putchar(c);
-                        line[size++] = c;
-                } else {
-                        putchar('\a');
+        char* result = 0;
+        uint16_t start = TCNT1;
+        int c;
+        while (!result && (uint16_t)(TCNT1 - start) < RX_BUDGET &&
+               (c = ringbuf_getc(uart_rxbuf)) != EOF) {
+                switch (c) {
+                case '\b':   // backspace deletes the last character
+                case '\x7f': // DEL
+                        if (size > 0) {
+                                backspace();
+                                --size;
+                        } else {
+                                print_char('\a');
+                        }
+                        break;
+                case '\r':
+                case '\n':
+                        print_char('\n');
+                        line[size] = 0;
+                        size = 0;
+                        result = line;
+                        break;
+                case 'c' & 0x1F: // ^c prints newline and clears buffer
+                        print_char('\n');
+                        size = 0;
+                        break;
+                case 'w' & 0x1F: // ^w kills the last word
+                        for (; size > 0 && line[size-1] != ' '; --size)
+                                backspace();
+                        break;
+                case 'u' & 0x1F: // ^u kills the entire buffer
+                        for (; size > 0; --size)
+                                backspace();
+                        break;
+                case '\t': // tab is replaced by space
+                        c = ' ';
+                        // fall through
+                default:
+                        if (size + 1 < sizeof (line)) {
+                                print_char(c);
+                                line[size++] = c;
+                        } else {
+                                print_char('\a');
+                        }
+                        break;
                 }
-                break;
         }
-        return 0;
+#ifdef UART_XONXOFF
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                if (uart_stat.xoff && ringbuf_used(uart_rxbuf) <= RX_XON) {
+                        uart_stat.xoff = 0;
+                        uart_stat.flow = XON;
+                        UCSR0B |= (1 << UDRIE);
+                }
+        }
+#endif
+        return result;
 }
 
+// Bytes with a framing error are discarded
 ISR(USART0_RX_vect) {
-        ringbuf_putc(uart_rxbuf, UDR0);
+        uint8_t status = UCSR0A;
+        char c = UDR0;
+        if (status & (1 << DOR))
+                ++uart_stat.overrun;
+        if (status & (1 << FE)) {
+                ++uart_stat.frame;
+                return;
+        }
+#ifdef UART_XONXOFF
+        // flow control of the host is not supported, the characters are ignored
+        if (c == XON || c == XOFF)
+                return;
+#endif
+        if (ringbuf_putc(uart_rxbuf, c) == EOF)
+                ++uart_stat.dropped;
+#ifdef UART_XONXOFF
+        if (!uart_stat.xoff && ringbuf_used(uart_rxbuf) >= RX_XOFF) {
+                uart_stat.xoff = 1;
+                uart_stat.flow = XOFF;
+                UCSR0B |= (1 << UDRIE);
+        }
+#endif
 }
 
 ISR(USART0_UDRE_vect) {
+#ifdef UART_XONXOFF
+        if (uart_stat.flow) {
+                UDR0 = uart_stat.flow;
+                uart_stat.flow = 0;
+                return;
+        }
+#endif
         if (!ringbuf_empty(uart_txbuf))
                 UDR0 = ringbuf_getc(uart_txbuf);
         else
                 UCSR0B &= ~(1 << UDRIE);
 }
+
+ISR(TIMER0_COMP_vect) {
+        ++timer_ticks;
+        timer_tick_cycles = TCNT1;
+}
+
+// Writes one byte of the queued records per interrupt, bytes which are
+// already in the EEPROM are skipped to save time and wear
+ISR(EE_READY_vect) {
+        while (eelog.read != eelog.write) {
+                const volatile uint8_t* rec = (const volatile uint8_t*)(eelog.buf + (eelog.read & (EELOG_QUEUE - 1)));
+                uint16_t addr = eelog.slot * sizeof (eelog_t) + eelog.pos;
+                uint8_t data = rec[eelog.pos];
+                if (++eelog.pos == sizeof (eelog_t)) {
+                        eelog.pos = 0;
+                        eelog.slot = (eelog.slot + 1) % EELOG_SLOTS;
+                        ++eelog.read;
+                }
+                if (hal_eeprom_read(addr) != data) {
+                        hal_eeprom_write(addr, data);
+                        return;
+                }
+        }
+        EECR &= ~(1 << EERIE);
+}
+
+#define IRQ_ISR_(name, port, bit)
+#define IRQ_ISR_1(name, port, bit) \
+        ISR(CAT(CAT(INT, IRQ_NUM_##port##bit), _vect)) { \
+                uint8_t level = (HAL_PIN(port) >> bit) & 1; \
+                irq_sense(IRQ_NUM_##port##bit, level); \
+                irq_capture(IN_##name, level); \
+        }
+#define IN(name, port, bit, alias, filter, irq) IRQ_ISR_##irq(name, port, bit)
+#include "generate.h"
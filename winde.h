@@ -0,0 +1,146 @@
+/**
+ * @file
+ */
+#ifndef WINDE_H
+#define WINDE_H
+
+#include <stdint.h>
+#include "hal.h"
+#include "pp.h"
+
+enum {
+#define STATE(name, attrs) STATE_##name,
+#include "generate.h"
+        STATE_COUNT
+};
+
+// Transitions per scan, 1 takes one transition per scan. With more, chains
+// like fehler_motor_aus -> temp_ok run to completion before the outputs
+// are written.
+#ifndef CHAIN_DEPTH
+#  define CHAIN_DEPTH 1
+#endif
+
+// Bit positions of the inputs in in_t.bitfield
+enum {
+#define IN(name, port, bit, alias, filter, irq) IN_##name,
+#include "generate.h"
+        IN_COUNT
+};
+#define IN(name, port, bit, alias, filter, irq) IF_EMPTY(alias,, enum { IN_##alias = IN_##name };)
+#include "generate.h"
+
+typedef union {
+        struct {
+#define IN(name, port, bit, alias, filter, irq) uint8_t name  : 1;
+#include "generate.h"
+        };
+        struct {
+#define IN(name, port, bit, alias, filter, irq) uint8_t alias : 1;
+#include "generate.h"
+        };
+        uint8_t bitfield[(IN_COUNT + 7) / 8];
+} in_t;
+
+// Bit positions of the outputs in out_t.bitfield
+enum {
+#define OUT(name, port, bit, alias) OUT_##name,
+#include "generate.h"
+        OUT_COUNT
+};
+
+typedef union {
+        struct {
+#define OUT(name, port, bit, alias) uint8_t name  : 1;
+#include "generate.h"
+        };
+        struct {
+#define OUT(name, port, bit, alias) uint8_t alias : 1;
+#include "generate.h"
+        };
+        uint8_t bitfield[(OUT_COUNT + 7) / 8];
+} out_t;
+
+// Index of each TRANSITION, named after its line in config.h
+enum {
+#define TRANSITION(initial, event, final, action, attrs) CAT(TRANSITION_, __LINE__),
+#include "generate.h"
+        TRANSITION_COUNT
+};
+
+// Timers of config.h and the timer of the latch reset in ports_reset
+enum {
+#define TIMER(name) TIMER_##name,
+#include "generate.h"
+        TIMER_latch_reset,
+        TIMER_COUNT
+};
+
+#define TICK_HZ 1000
+
+// Time based events and actions of config.h, host/statecheck overrides TIMER_DUE
+#define TIMER_TICKS(ms)       ((uint32_t)(ms) * TICK_HZ / 1000)
+#ifndef TIMER_DUE
+#  define TIMER_DUE(deadline) ((int32_t)(timer_now - (deadline)) >= 0)
+#endif
+#define AFTER(ms)             TIMER_DUE(state_entered + TIMER_TICKS(ms))
+#define TIMER_START(name, ms) timer_start(TIMER_##name, ms)
+#define TIMER_STOP(name)      (timer_running &= ~((uint16_t)1 << TIMER_##name))
+#define TIMER_EXPIRED(name)   ((timer_running >> TIMER_##name & 1) && TIMER_DUE(timer_deadline[TIMER_##name]))
+
+typedef struct {
+        uint8_t manual            : 1;
+        uint8_t prompt_active     : 1;
+        uint8_t fehler_einkuppeln : 1;
+        uint8_t fehler_auskuppeln : 1;
+        uint8_t ports_dirty       : 1;
+        uint8_t telemetry         : 1;
+        uint8_t latch_reset       : 1;
+} flag_t;
+
+// Telemetry frame: TELEMETRY_SYNC, payload length, payload, CRC-8 of length
+// and payload. The payload starts with the TELEMETRY_* flags of the fields
+// which follow and the low 16 bits of the tick counter. The fields are only
+// sent if they changed, except in every TELEMETRY_FULL-th frame.
+#define TELEMETRY_SYNC  0xA5
+#define TELEMETRY_IN    0x01
+#define TELEMETRY_OUT   0x02
+#define TELEMETRY_STATE 0x04
+#define TELEMETRY_FULL  32
+#define TELEMETRY_SIZE  (7 + sizeof (in_t) + sizeof (out_t))
+
+// Lookup table of the command names and the port names and aliases,
+// generated by host/genlookup.c. Each slot holds the kind in the upper two
+// bits, the alias flag and the index in cmd_list, in_list or out_list.
+enum { LOOKUP_CMD = 1, LOOKUP_OUT };
+#define LOOKUP_ALIAS 0x20
+#define LOOKUP_INDEX 0x1F
+#define LOOKUP_SIZE  256
+
+static inline uint8_t lookup_hash(uint16_t seed, uint8_t kind, const char* s) {
+        uint16_t h = seed ^ kind;
+        while (*s)
+                h = (h ^ (uint8_t)*s++) * 0x193;
+        return h ^ (h >> 8);
+}
+
+extern in_t    in, last_in, in_raw;
+extern out_t   out;
+extern flag_t  flag;
+extern uint8_t state, state_transition;
+extern volatile uint32_t timer_ticks;
+// Tick of the current scan, state_entered is the tick of the last transition
+extern uint32_t timer_now, state_entered, timer_deadline[TIMER_COUNT];
+extern uint16_t timer_running;
+
+void         winde_init();
+void         winde_scan();
+void         control_scan();
+void         control_step();
+uint32_t     timer_get();
+void         timer_start(uint8_t timer, uint16_t ms);
+uint8_t      state_update();
+void         state_enter(uint8_t new_state);
+const char*  state_str(uint8_t state);
+
+#endif